@@ -0,0 +1,35 @@
+import os
+import re
+import subprocess
+import sys
+
+# Runs a batch of every rom in roms with and without lockstep and checks every machine ended up the same
+# py scripts/lockstep_check.py [machines] [frames]
+# roms/halt_timer_test.ch8 halts partway through its first frame with both timers running
+
+machines = sys.argv[1] if len(sys.argv) > 1 else "64"
+frames = sys.argv[2] if len(sys.argv) > 2 else "300"
+
+headless = "out/Release/c8-headless.exe" if os.name == "nt" else "out/c8-headless"
+
+def hashes(rom, flag):
+    output = subprocess.run([headless, rom, "-b" + machines, "-p1", "-n" + frames, flag],
+        capture_output=True, text=True).stdout
+    return (re.search(r"Combined framebuffer hash: (\w+)", output).group(1), re.search(r"Combined state hash: (\w+)", output).group(1))
+
+failed = 0
+for name in sorted(os.listdir("roms")):
+    if not name.endswith(".ch8"):
+        continue
+    rom = os.path.join("roms", name)
+    expected = hashes(rom, "-eswitch")
+    differs = 0
+    for lanes in ["8", "16", "32"]:
+        got = hashes(rom, "-k" + lanes)
+        if got != expected:
+            print("%s with -k%s: state %s, expected %s" % (name, lanes, got[1], expected[1]))
+            differs += 1
+    failed += differs
+    print("%-28s %s" % (name, "differs" if differs else "matches"))
+
+sys.exit(1 if failed else 0)
\ No newline at end of file
@@ -14,4 +14,5 @@ shutil.copy("out/Release/c8.exe", "release/chip8/c8.exe")
 shutil.copy("out/Release/c8a.exe", "release/chip8/c8a.exe")
 shutil.copy("out/Release/SDL2.dll", "release/chip8/SDL2.dll")
 shutil.copytree("fonts", "release/chip8/fonts")
+shutil.copytree("keymaps", "release/chip8/keymaps")
 shutil.copytree("roms", "release/chip8/roms")
\ No newline at end of file
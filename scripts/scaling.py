@@ -0,0 +1,25 @@
+import os
+import re
+import subprocess
+import sys
+
+# Runs a batch of machines on 1, 2, 4 ... 64 threads and prints instructions/sec for each
+# py scripts/scaling.py [rom] [machines] [frames]
+
+rom = sys.argv[1] if len(sys.argv) > 1 else "roms/1dcell.ch8"
+machines = sys.argv[2] if len(sys.argv) > 2 else "1024"
+frames = sys.argv[3] if len(sys.argv) > 3 else "600"
+
+headless = "out/Release/c8-headless.exe" if os.name == "nt" else "out/c8-headless"
+
+print("Threads  Instructions/sec  Speedup  Stolen")
+base = None
+threads = 1
+while threads <= 64:
+    output = subprocess.run([headless, rom, "-b" + machines, "-p" + str(threads), "-n" + frames, "-t1000000"],
+        capture_output=True, text=True).stdout
+    rate = float(re.search(r"Instructions/sec: (\d+)", output).group(1))
+    stolen = re.search(r"stolen \(([\d.]+%)\)", output).group(1)
+    base = base or rate
+    print("%7d  %16.0f  %6.2fx  %6s" % (threads, rate, rate / base, stolen))
+    threads *= 2
\ No newline at end of file
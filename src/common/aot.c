@@ -0,0 +1,143 @@
+#include "aot.h"
+
+#include "chip8.h"
+#include "instructions.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+
+#include <dlfcn.h>
+
+struct aot_state
+{
+    void *library;
+    const struct aot_module *module;
+    struct chip8 *owner;
+    u8 *valid; // Per block, whether memory still holds the bytes it was compiled from
+};
+
+static struct aot_state aot;
+
+static void aot_execute(struct chip8 *state, u16 opcode)
+{
+    struct instruction instruction;
+    decode_instruction(opcode, &instruction);
+    if (!execute_instruction(state, &instruction))
+    {
+        state->halt = 1;
+    }
+}
+
+u8 aot_load(const char *path)
+{
+    aot_unload();
+
+    printf("Loading compiled rom: %s\n", path);
+    aot.library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (aot.library == NULL)
+    {
+        printf("Failed to load compiled rom: %s\n", dlerror());
+        return 0;
+    }
+
+    aot.module = (const struct aot_module *)dlsym(aot.library, AOT_MODULE_SYMBOL);
+    if (aot.module == NULL || aot.module->abi_version != AOT_ABI_VERSION)
+    {
+        printf("%s isn't a compiled rom for this version of c8\n", path);
+        aot_unload();
+        return 0;
+    }
+
+    aot.valid = (u8 *)calloc(aot.module->block_count, 1);
+
+    printf("Loaded %u compiled blocks\n\n", aot.module->block_count);
+    return 1;
+}
+
+void aot_unload()
+{
+    if (aot.library != NULL) dlclose(aot.library);
+    free(aot.valid);
+    memset(&aot, 0, sizeof(aot));
+}
+
+// Checks every block against memory and marks translated addresses as decoded so writes to them raise code_modified
+static void aot_verify(struct chip8 *state)
+{
+    const struct aot_module *module = aot.module;
+    for (u32 b = 0; b < module->block_count; b++)
+    {
+        const struct aot_block *block = &module->blocks[b];
+        u32 size = (u32)block->length * 2;
+        aot.valid[b] = memcmp(&state->memory[block->address], &module->rom[block->address - module->rom_start], size) == 0;
+        if (!aot.valid[b]) continue;
+
+        for (u16 address = block->address; address < block->address + size; address += 2)
+        {
+            u16 instruction_bytes = ((u16)state->memory[address] << 8) + (u16)state->memory[address + 1];
+            decode_instruction(instruction_bytes, &state->decoded[address]);
+            state->decoded_valid[address] = 1;
+        }
+    }
+
+    aot.owner = state;
+    state->code_modified = 0;
+}
+
+u64 aot_run(struct chip8 *state, u64 count)
+{
+    if (aot.module == NULL) return run_instructions(state, count);
+
+    if (aot.owner != state) aot_verify(state);
+
+    struct aot_env env;
+    env.state = state;
+    env.v = state->cpu.v;
+    env.i = &state->cpu.i;
+    env.pc = &state->cpu.pc;
+    env.delay = &state->cpu.delay;
+    env.sound = &state->cpu.sound;
+    env.halt = &state->halt;
+    env.await_input = &state->await_input;
+    env.code_modified = &state->code_modified;
+    env.valid = aot.valid;
+    env.execute = aot_execute;
+
+    u64 n = 0;
+    u64 compiled = 0;
+    while (n < count && !state->halt && !state->await_input)
+    {
+        if (state->code_modified) aot_verify(state);
+
+        u64 ran = aot.module->run(&env, count - n);
+        n += ran;
+        compiled += ran;
+
+        // Nothing compiled can run from here, interpret one instruction
+        if (ran == 0) n += run_instructions(state, 1);
+    }
+    state->cycles += compiled;
+    return n;
+}
+
+#else
+
+u8 aot_load(const char *path)
+{
+    printf("Compiled roms aren't supported on this platform\n");
+    return 0;
+}
+
+void aot_unload()
+{
+}
+
+u64 aot_run(struct chip8 *state, u64 count)
+{
+    return run_instructions(state, count);
+}
+
+#endif
\ No newline at end of file
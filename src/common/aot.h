@@ -0,0 +1,66 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+#include "types.h"
+
+/*
+Ahead of time compiled roms
+
+c8aot translates a rom into C and compiles it into a shared library exporting
+a struct aot_module named c8aot_module. Every basic block becomes a labelled run of
+C inside a single run function, blocks chain straight into each other with goto
+while the instruction budget lasts, and V registers live in locals the whole time
+
+This header is the whole interface between the generated code and the emulator, so it
+only depends on types.h. Generated code sees the machine through struct aot_env and
+runs anything complicated through env->execute, which calls execute_instruction
+
+A block only runs while memory still holds the bytes it was compiled from, anything
+else (self modifying code, addresses that weren't reached statically) is interpreted
+*/
+
+#define AOT_ABI_VERSION 1
+#define AOT_MODULE_SYMBOL "c8aot_module"
+
+struct chip8;
+
+struct aot_env
+{
+    struct chip8 *state;
+    u8 *v;
+    u16 *i;
+    u16 *pc;
+    u8 *delay;
+    u8 *sound;
+    u8 *halt;
+    u8 *await_input;
+    u8 *code_modified;
+    const u8 *valid; // Per block, whether it still matches memory
+    void (*execute)(struct chip8 *state, u16 opcode); // pc must already point after the instruction
+};
+
+struct aot_block
+{
+    u16 address;
+    u16 length; // Instructions
+};
+
+struct aot_module
+{
+    u32 abi_version;
+    u32 block_count;
+    const struct aot_block *blocks;
+    u16 rom_start;
+    u16 rom_size;
+    const u8 *rom; // The bytes the blocks were compiled from
+
+    // Runs blocks from pc until the budget runs out or it reaches something it can't run, returns instructions run
+    u64 (*run)(const struct aot_env *env, u64 budget);
+};
+
+// Runtime, not used by generated code
+u8 aot_load(const char *path); // Returns 0 on failure
+void aot_unload();
+u64 aot_run(struct chip8 *state, u64 count); // Runs until count, halt or awaiting input, returns instructions run
+
+#endif //_AOT_H_
\ No newline at end of file
@@ -0,0 +1,399 @@
+#include "batch.h"
+
+#include "chip8.h"
+#include "lockstep.h"
+#include "platform.h"
+#include "snapshot.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_TASK -1
+#define CACHE_LINE 64
+
+struct batch_machine
+{
+    struct chip8 state;
+    struct frame_scheduler scheduler; // Only for the instruction budget
+    u64 frames;
+};
+
+struct batch_group
+{
+    struct lockstep lockstep;
+    struct frame_scheduler scheduler; // Every lane gets the same budget
+    u32 first; // Machine in lane 0, the rest follow it
+};
+
+// Top and bottom sit on their own cache lines, thieves only ever touch top
+struct batch_deque
+{
+    volatile i64 top; // Oldest task, where thieves take from
+    u8 pad_top[CACHE_LINE - sizeof(i64)];
+    volatile i64 bottom; // One past the newest task, only the owner moves it
+    u8 pad_bottom[CACHE_LINE - sizeof(i64)];
+    u32 *tasks; // Machine or group indices, indexed by position & batch.mask
+};
+
+struct batch_worker
+{
+    struct batch_deque deque;
+    u64 random; // Picks where to start looking for work to steal
+
+    // Stats
+    u64 slices;
+    u64 stolen;
+    u64 failed_steals; // Rounds through every other deque that found nothing
+    u64 instructions;
+    u64 busy_ns;
+    u8 pad[CACHE_LINE];
+};
+
+struct batch_state
+{
+    struct batch_machine *machines;
+    struct batch_group *groups; // Only when running lockstep
+    struct batch_worker *workers;
+    u32 *tasks;
+    u64 mask;
+    u32 threads;
+    u64 frames;
+    enum engine engine;
+    u32 lanes;
+    volatile i64 live; // Tasks that haven't finished
+};
+
+static struct batch_state batch;
+
+static void push(struct batch_deque *deque, u32 task)
+{
+    i64 bottom = pf_atomic_load(&deque->bottom);
+    deque->tasks[bottom & batch.mask] = task;
+    pf_atomic_store(&deque->bottom, bottom + 1);
+}
+
+// Owner only, takes the newest task
+static i64 pop(struct batch_deque *deque)
+{
+    i64 bottom = pf_atomic_load(&deque->bottom) - 1;
+    pf_atomic_store(&deque->bottom, bottom);
+    i64 top = pf_atomic_load(&deque->top);
+    if (top > bottom)
+    {
+        pf_atomic_store(&deque->bottom, bottom + 1);
+        return NO_TASK;
+    }
+
+    i64 task = deque->tasks[bottom & batch.mask];
+    if (top == bottom)
+    {
+        // The last task, a thief may be after it too
+        if (!pf_atomic_cas(&deque->top, top, top + 1)) task = NO_TASK;
+        pf_atomic_store(&deque->bottom, bottom + 1);
+    }
+    return task;
+}
+
+// Anyone, takes the oldest task, NO_TASK if it's empty or another thread got there first
+static i64 steal_from(struct batch_deque *deque)
+{
+    i64 top = pf_atomic_load(&deque->top);
+    i64 bottom = pf_atomic_load(&deque->bottom);
+    if (top >= bottom) return NO_TASK;
+
+    i64 task = deque->tasks[top & batch.mask];
+    if (!pf_atomic_cas(&deque->top, top, top + 1)) return NO_TASK;
+    return task;
+}
+
+static i64 steal(struct batch_worker *worker, u32 index)
+{
+    // xorshift64, each thread starts looking somewhere different
+    worker->random ^= worker->random << 13;
+    worker->random ^= worker->random >> 7;
+    worker->random ^= worker->random << 17;
+
+    u32 start = (u32)(worker->random % batch.threads);
+    for (u32 i = 0; i < batch.threads; i++)
+    {
+        u32 victim = (start + i) % batch.threads;
+        if (victim == index) continue;
+
+        i64 task = steal_from(&batch.workers[victim].deque);
+        if (task != NO_TASK)
+        {
+            worker->stolen++;
+            return task;
+        }
+    }
+    worker->failed_steals++;
+    return NO_TASK;
+}
+
+static u8 waiting_forever(struct chip8 *state)
+{
+    return state->await_input && state->cpu.delay == 0 && state->cpu.sound == 0;
+}
+
+static u8 finished(struct batch_machine *machine)
+{
+    return machine->frames >= batch.frames || machine->state.halt || waiting_forever(&machine->state);
+}
+
+// Returns 1 if the machine has frames left to run
+static u8 run_slice(struct batch_worker *worker, struct batch_machine *machine)
+{
+    u64 start_ns = pf_get_time_ns();
+    struct chip8 *state = &machine->state;
+    u64 cycles = state->cycles;
+    for (u32 frame = 0; frame < BATCH_SLICE_FRAMES && !finished(machine); frame++)
+    {
+        run_engine(state, batch.engine, scheduler_budget(&machine->scheduler));
+        tick_timers(state);
+        machine->frames++;
+    }
+
+    worker->slices++;
+    worker->instructions += state->cycles - cycles;
+    worker->busy_ns += pf_get_time_ns() - start_ns;
+    return !finished(machine);
+}
+
+static u8 group_finished(struct batch_group *group)
+{
+    for (u32 l = 0; l < group->lockstep.lanes; l++)
+    {
+        if (!finished(&batch.machines[group->first + l])) return 0;
+    }
+    return 1;
+}
+
+// Lanes that have finished sit in the group doing nothing, they've either halted, are waiting forever or ran out of frames with everyone else
+static u8 run_group_slice(struct batch_worker *worker, struct batch_group *group)
+{
+    u64 start_ns = pf_get_time_ns();
+    u64 instructions = group->lockstep.lane_instructions;
+    for (u32 frame = 0; frame < BATCH_SLICE_FRAMES && !group_finished(group); frame++)
+    {
+        for (u32 l = 0; l < group->lockstep.lanes; l++)
+        {
+            struct batch_machine *machine = &batch.machines[group->first + l];
+            if (!finished(machine)) machine->frames++;
+        }
+        lockstep_frame(&group->lockstep, scheduler_budget(&group->scheduler));
+    }
+
+    worker->slices++;
+    worker->instructions += group->lockstep.lane_instructions - instructions;
+    worker->busy_ns += pf_get_time_ns() - start_ns;
+    return !group_finished(group);
+}
+
+static void worker_main(u32 index, void *data)
+{
+    struct batch_state *state = data;
+    struct batch_worker *worker = &state->workers[index];
+    while (pf_atomic_load(&state->live) > 0)
+    {
+        i64 task = pop(&worker->deque);
+        if (task == NO_TASK) task = steal(worker, index);
+        if (task == NO_TASK)
+        {
+            // Everything left is being run by someone else
+            pf_yield();
+            continue;
+        }
+
+        u8 more = state->lanes ? run_group_slice(worker, &state->groups[task]) : run_slice(worker, &state->machines[task]);
+        if (more)
+            push(&worker->deque, (u32)task);
+        else
+            pf_atomic_add(&state->live, -1);
+    }
+}
+
+static void free_batch()
+{
+    free(batch.machines);
+    free(batch.groups);
+    free(batch.workers);
+    free(batch.tasks);
+    memset(&batch, 0, sizeof(batch));
+}
+
+static void print_batch_report(struct batch_options *options, u64 elapsed_ns)
+{
+    u64 instructions = 0;
+    u64 frames = 0;
+    u32 halted = 0;
+    u32 waiting = 0;
+    u64 hash = 0xcbf29ce484222325;
+    u64 state_hash = 0xcbf29ce484222325;
+    static u8 payload[SNAPSHOT_PAYLOAD_SIZE];
+    for (u32 k = 0; k < options->machines; k++)
+    {
+        struct batch_machine *machine = &batch.machines[k];
+        instructions += machine->state.cycles;
+        frames += machine->frames;
+        if (machine->state.halt) halted++;
+        else if (waiting_forever(&machine->state)) waiting++;
+
+        // FNV-1a over every screen's hash in machine order, the same for any number of threads
+        u64 screen = hash_screen(&machine->state);
+        for (int byte = 0; byte < 8; byte++)
+        {
+            hash ^= (u8)(screen >> (8 * byte));
+            hash *= 0x100000001b3;
+        }
+
+        // And over the whole of every machine, registers, timers, memory, stack and cycles included
+        write_snapshot_payload(&machine->state, payload);
+        u64 checksum = snapshot_checksum(payload, SNAPSHOT_PAYLOAD_SIZE);
+        for (int byte = 0; byte < 8; byte++)
+        {
+            state_hash ^= (u8)(checksum >> (8 * byte));
+            state_hash *= 0x100000001b3;
+        }
+    }
+
+    f64 seconds = elapsed_ns / 1000000000.0;
+    if (seconds <= 0.0) seconds = 1e-9;
+    if (options->lanes)
+        printf("Batch: %" PRIu32 " machines on %" PRIu32 " threads, up to %" PRIu64 " frames each, lockstep groups of %" PRIu32 "\n",
+            options->machines, options->threads, options->frames, options->lanes);
+    else
+        printf("Batch: %" PRIu32 " machines on %" PRIu32 " threads, up to %" PRIu64 " frames each, engine %s\n",
+            options->machines, options->threads, options->frames, engine_names[options->engine]);
+    printf("Executed %" PRIu64 " instructions over %" PRIu64 " frames in %.3f s\n", instructions, frames, seconds);
+    printf("Instructions/sec: %.0f (%.0f per thread)\n", instructions / seconds, instructions / seconds / options->threads);
+    printf("Frames/sec: %.0f\n", frames / seconds);
+    printf("Machines: %" PRIu32 " ran every frame, %" PRIu32 " halted, %" PRIu32 " waiting for a key\n",
+        options->machines - halted - waiting, halted, waiting);
+    printf("Combined framebuffer hash: %016" PRIx64 "\n", hash);
+    printf("Combined state hash: %016" PRIx64 "\n", state_hash);
+
+    if (options->lanes)
+    {
+        u32 groups = (options->machines + options->lanes - 1) / options->lanes;
+        u64 steps = 0;
+        u64 lane_instructions = 0;
+        u64 scalar = 0;
+        for (u32 g = 0; g < groups; g++)
+        {
+            steps += batch.groups[g].lockstep.steps;
+            lane_instructions += batch.groups[g].lockstep.lane_instructions;
+            scalar += batch.groups[g].lockstep.scalar_instructions;
+        }
+        printf("Lockstep: %" PRIu64 " steps, %.2f of %" PRIu32 " lanes each (%.1f%%), %.1f%% of instructions run lane by lane\n",
+            steps, steps ? (f64)lane_instructions / steps : 0.0, options->lanes,
+            steps ? 100.0 * lane_instructions / ((f64)steps * options->lanes) : 0.0,
+            lane_instructions ? 100.0 * scalar / lane_instructions : 0.0);
+    }
+
+    u64 slices = 0;
+    u64 stolen = 0;
+    u64 failed = 0;
+    for (u32 i = 0; i < options->threads; i++)
+    {
+        slices += batch.workers[i].slices;
+        stolen += batch.workers[i].stolen;
+        failed += batch.workers[i].failed_steals;
+    }
+    printf("Slices: %" PRIu64 " of %d frames, %" PRIu64 " stolen (%.2f%%), %" PRIu64 " times a thread found nothing to steal\n",
+        slices, BATCH_SLICE_FRAMES, stolen, slices ? 100.0 * stolen / slices : 0.0, failed);
+    for (u32 i = 0; i < options->threads; i++)
+    {
+        struct batch_worker *worker = &batch.workers[i];
+        printf("  Thread %2" PRIu32 ": %8" PRIu64 " slices, %6" PRIu64 " stolen, %12" PRIu64 " instructions, busy %5.1f%%\n",
+            i, worker->slices, worker->stolen, worker->instructions, 100.0 * worker->busy_ns / elapsed_ns);
+    }
+}
+
+u8 run_batch(struct chip8 *prototype, struct batch_options *options)
+{
+    if (options->lanes == 0 && options->engine != ENGINE_UNCACHED && options->engine != ENGINE_SWITCH && options->engine != ENGINE_THREADED)
+    {
+        printf("Batches run with uncached, switch or threaded, %s keeps the machine it's running in globals\n", engine_names[options->engine]);
+        return 0;
+    }
+    if (options->threads == 0 || options->threads > PF_MAX_THREADS)
+    {
+        printf("Threads should be between 1 and %d\n", PF_MAX_THREADS);
+        return 0;
+    }
+    if (options->machines == 0)
+    {
+        printf("A batch needs at least one machine\n");
+        return 0;
+    }
+    if (options->lanes > LOCKSTEP_LANES)
+    {
+        printf("Lockstep groups have at most %d lanes\n", LOCKSTEP_LANES);
+        return 0;
+    }
+
+    free_batch();
+    u32 tasks = options->lanes ? (options->machines + options->lanes - 1) / options->lanes : options->machines;
+    u64 capacity = 1;
+    while (capacity < tasks) capacity *= 2;
+    batch.machines = malloc(sizeof(struct batch_machine) * options->machines);
+    if (options->lanes) batch.groups = malloc(sizeof(struct batch_group) * tasks);
+    batch.workers = malloc(sizeof(struct batch_worker) * options->threads);
+    batch.tasks = malloc(sizeof(u32) * capacity * options->threads);
+    if (batch.machines == NULL || batch.workers == NULL || batch.tasks == NULL || (options->lanes && batch.groups == NULL))
+    {
+        printf("Failed to allocate %" PRIu32 " machines\n", options->machines);
+        free_batch();
+        return 0;
+    }
+    batch.mask = capacity - 1;
+    batch.threads = options->threads;
+    batch.frames = options->frames;
+    batch.engine = options->engine;
+    batch.lanes = options->lanes;
+
+    memset(batch.workers, 0, sizeof(struct batch_worker) * options->threads);
+    for (u32 i = 0; i < options->threads; i++)
+    {
+        batch.workers[i].deque.tasks = &batch.tasks[capacity * i];
+        batch.workers[i].random = 0x9E3779B97F4A7C15ull * (i + 1);
+    }
+
+    // Machines, or lockstep groups of them, are dealt out round robin, stealing evens out whatever that gets wrong
+    static u8 payload[SNAPSHOT_PAYLOAD_SIZE];
+    write_snapshot_payload(prototype, payload);
+    for (u32 k = 0; k < options->machines; k++)
+    {
+        struct batch_machine *machine = &batch.machines[k];
+        init_chip8(&machine->state);
+        read_snapshot_payload(&machine->state, payload);
+        seed_random(&machine->state, (u64)options->seed + k);
+        create_scheduler(&machine->scheduler, options->tick_rate);
+        machine->frames = 0;
+        if (!options->lanes) push(&batch.workers[k % options->threads].deque, k);
+    }
+    for (u32 g = 0; options->lanes && g < tasks; g++)
+    {
+        struct batch_group *group = &batch.groups[g];
+        init_lockstep(&group->lockstep);
+        create_scheduler(&group->scheduler, options->tick_rate);
+        group->first = g * options->lanes;
+        for (u32 k = group->first; k < options->machines && k < group->first + options->lanes; k++)
+        {
+            add_lockstep_lane(&group->lockstep, &batch.machines[k].state);
+        }
+        push(&batch.workers[g % options->threads].deque, g);
+    }
+    batch.live = tasks;
+
+    u64 start_ns = pf_get_time_ns();
+    u8 started = pf_run_threads(options->threads, worker_main, &batch);
+    u64 elapsed_ns = pf_get_time_ns() - start_ns;
+    if (!started) printf("Not every thread started, the ones that did ran the whole batch\n");
+
+    print_batch_report(options, elapsed_ns);
+    free_batch();
+    return 1;
+}
\ No newline at end of file
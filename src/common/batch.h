@@ -0,0 +1,49 @@
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include "types.h"
+#include "engine.h"
+
+/*
+Batch runner
+
+Runs many independent machines from the same starting state across a pool of threads, for
+sweeps over seeds and for measuring how the interpreter scales with cores. Machine k is
+seeded with seed + k and runs on its own, nothing is shared between machines
+
+The work is tasks of "run machine k for BATCH_SLICE_FRAMES frames". Every thread owns a
+Chase-Lev deque of machine indices: it pushes and pops at the bottom, and when it runs dry
+it steals from the top of another thread's. A machine that still has frames left after its
+slice goes back on the bottom of the deque of the thread that ran it, so it stays in that
+core's cache unless someone idle takes it. Machines that halt, wait on Fx0A with both timers
+at 0 (a batch has no keys, so they'd never move again) or run all their frames are dropped
+and never occupy a thread again
+
+The deques never grow, each one has room for every machine since a machine is only ever in
+one deque at a time
+
+jit, aot and fused keep the machine they're running in globals so they can't be shared
+between threads, batches run with uncached, switch or threaded
+
+With lanes set, machines are put in lockstep groups of that many (lockstep.h) and a task runs
+a whole group, one instruction across every lane at once, instead of one machine
+*/
+
+#define BATCH_SLICE_FRAMES 60
+
+struct chip8;
+
+struct batch_options
+{
+    u32 machines;
+    u32 threads; // Up to PF_MAX_THREADS
+    u64 frames; // For every machine
+    u32 tick_rate;
+    u32 seed; // Machine k is seeded with seed + k
+    enum engine engine; // Unused by lockstep groups
+    u32 lanes; // 0 runs machines one at a time on engine, otherwise up to LOCKSTEP_LANES
+};
+
+u8 run_batch(struct chip8 *prototype, struct batch_options *options); // Every machine starts as a copy of prototype, prints a report, returns 0 on failure
+
+#endif //_BATCH_H_
\ No newline at end of file
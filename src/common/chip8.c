@@ -1,29 +1,8 @@
 #include "chip8.h"
 
-#include "platform.h"
-
 #include <stdio.h>
 #include <string.h>
 
-int chip8_keys[NUM_CHIP_KEYS] = {
-    SDL_SCANCODE_X, // 0x0
-    SDL_SCANCODE_1, // 0x1
-    SDL_SCANCODE_2, // 0x2
-    SDL_SCANCODE_3, // 0x3
-    SDL_SCANCODE_Q, // 0x4
-    SDL_SCANCODE_W, // 0x5
-    SDL_SCANCODE_E, // 0x6
-    SDL_SCANCODE_A, // 0x7
-    SDL_SCANCODE_S, // 0x8
-    SDL_SCANCODE_D, // 0x9
-    SDL_SCANCODE_Z, // 0xA
-    SDL_SCANCODE_C, // 0xB
-    SDL_SCANCODE_4, // 0xC
-    SDL_SCANCODE_R, // 0xD
-    SDL_SCANCODE_F, // 0xE
-    SDL_SCANCODE_V, // 0xF
-};
-
 void init_chip8(struct chip8 *state)
 {
     state->cpu.pc = 0x200; // Program should be loaded in at 0x200 since OG hardware stored emulator from 0x000 to 0x1FF
@@ -32,13 +11,18 @@ void init_chip8(struct chip8 *state)
     state->cpu.sound = 0;
     memset(state->cpu.v, 0, 16);
     memset(state->memory, 0, MEMORY_SIZE);
-    memset(state->screen, 0, DISPLAY_SIZE);
+    memset(state->screen, 0, sizeof(state->screen));
+    state->screen_dirty = 1;
     memset(state->stack, 0, STACK_SIZE);
     state->sp = state->stack; // Set stack pointer to the beginning of the stack
     state->cycles = 0;
     state->halt = 0;
     state->await_input = 0;
     state->input_register = 0;
+    state->keys = 0;
+    seed_random(state, 0);
+    memset(state->decoded_valid, 0, MEMORY_SIZE);
+    state->code_modified = 1; // Anything an engine has cached belongs to the previous contents of memory
 }
 
 void print_cpu(struct chip8 *state)
@@ -59,71 +43,78 @@ void print_cpu(struct chip8 *state)
     );
 }
 
-u8 save_state(struct chip8 *state)
+u8 load_rom(struct chip8 *state, const char *path)
 {
-    FILE *file;
-    if (!pf_mkdir("states"))
+    // Load rom into memory at location 0x200
+    printf("Loading rom: \"%s\"\n", path);
+
+    FILE *rom_file = fopen(path, "rb");
+    if (rom_file == NULL)
     {
-        printf("./states directory already exists\n");
+        printf("Failed to open rom file: %s\n", path);
+        return 0;
     }
-    if (fopen_s(&file, "states/state.ch8", "w") != 0)
+
+    fseek(rom_file, 0, SEEK_END);
+    int rom_size = (int)ftell(rom_file);
+    fseek(rom_file, 0, SEEK_SET);
+
+    if (rom_size > MEMORY_SIZE - 0x200)
     {
-        printf("Failed to open states/state.ch8\n");
+        printf("Rom size is %d bytes which is too large to fit in memory\n", rom_size);
+        fclose(rom_file);
         return 0;
     }
 
-    // Registers
-    fputc((state->cpu.pc >> 8) & 0xFF, file); // PC higher
-    fputc(state->cpu.pc & 0xFF, file); // PC lower
+    printf("Rom size is %d bytes, reading into memory\n\n", rom_size);
 
-    fputc((state->cpu.i >> 8) & 0xFF, file); // i higher
-    fputc(state->cpu.i & 0xFF, file); // i lower
+    fread(&state->memory[0x200], 1, rom_size, rom_file);
+    fclose(rom_file);
+    return 1;
+}
 
-    fputc(state->cpu.delay, file); // delay
-    fputc(state->cpu.sound, file); // sound
+u8 load_font(struct chip8 *state, const char *path)
+{
+    printf("Loading font: %s\n", path);
 
-    for (int i = 0; i < 16; i++)
+    FILE *font_file = fopen(path, "rb");
+    if (font_file == NULL)
     {
-        fputc(state->cpu.v[i], file); // v[0x0] - v[0xF] in order
+        printf("Failed to open font file: %s\n", path);
+        return 0;
     }
 
-    // Memory
-    for (int i = 0; i < MEMORY_SIZE; i++)
-    {
-        fputc(state->memory[i], file);
-    }
+    fseek(font_file, 0, SEEK_END);
+    int font_size = (int)ftell(font_file);
+    fseek(font_file, 0, SEEK_SET);
 
-    // Screen
-    for (int i = 0; i < DISPLAY_SIZE; i++)
+    if (font_size < 80)
     {
-        fputc(state->screen[i], file);
+        printf("Font file size is %d bytes, it should be 80 bytes\n", font_size);
+        fclose(font_file);
+        return 0;
     }
-
-    // Stack
-    for (int i = 0; i < STACK_SIZE; i++)
+    else if (font_size > 80)
     {
-        fputc(state->stack[i], file);
+        printf("Font file size is %d bytes, taking first 80 bytes\n", font_size);
     }
+    printf("\n");
+
+    fread(&state->memory[0x50], 1, 80, font_file);
+    fclose(font_file);
+    return 1;
+}
 
-    size_t sp = (size_t)state->sp;
-    for (int byte = 0; byte < sizeof(size_t); byte++) // sp high-low
+void tick_timers(struct chip8 *state)
+{
+    if (state->cpu.delay > 0)
     {
-        fputc((int)(sp >> (8 * byte)), file);
+        state->cpu.delay--;
     }
-
-    // Variables
-
-    for (int byte = 0; byte < 8; byte++) // Cycles high-low
+    if (state->cpu.sound > 0)
     {
-        fputc((int)(state->cycles >> (8 * byte)), file);
+        state->cpu.sound--;
     }
-
-    fputc((int)state->halt, file);
-    fputc((int)state->await_input, file);
-    fputc((int)state->input_register, file);
-
-    fclose(file);
-    return 1;
 }
 
 void print_screen(struct chip8 *state)
@@ -132,50 +123,90 @@ void print_screen(struct chip8 *state)
     {
         for (int i = 0; i < DISPLAY_WIDTH; i++)
         {
-            printf("%d", state->screen[j * DISPLAY_WIDTH + i]);
+            printf("%d", get_pixel(state, i, j));
         }
         printf("\n");
     }
     printf("\n");
 }
 
+u8 get_pixel(struct chip8 *state, int width, int height)
+{
+    return (state->screen[height] & PIXEL_BIT(width)) != 0;
+}
+
 void set_pixel(struct chip8 *state, int width, int height)
 {
-    state->screen[height * DISPLAY_WIDTH + width] = (u8)1;
+    state->screen[height] |= PIXEL_BIT(width);
 }
 
 void clear_pixel(struct chip8 *state, int width, int height)
 {
-    state->screen[height * DISPLAY_WIDTH + width] = (u8)0;
+    state->screen[height] &= ~PIXEL_BIT(width);
 }
 
 u8 toggle_pixel(struct chip8 *state, int width, int height)
 {
-    int i = height * DISPLAY_WIDTH + width;
-    if (state->screen[i] == (u8)0)
-    {
-        state->screen[i] = (u8)1;
-        return (u8)1;
-    }
-    else if (state->screen[i] == (u8)1)
+    state->screen[height] ^= PIXEL_BIT(width);
+    return get_pixel(state, width, height);
+}
+
+u64 hash_screen(struct chip8 *state)
+{
+    // Rows are hashed most significant byte first so the hash doesn't depend on host endianness
+    u64 hash = 0xcbf29ce484222325;
+    for (int j = 0; j < DISPLAY_HEIGHT; j++)
     {
-        state->screen[i] = (u8)0;
-        return (u8)0;
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            hash ^= (state->screen[j] >> shift) & 0xFF;
+            hash *= 0x100000001b3;
+        }
     }
-    else
+    return hash;
+}
+
+u8 get_chip_key(u16 keys)
+{
+    for (u8 i = 0; i < NUM_CHIP_KEYS; i++)
     {
-        printf("Trying to toggle pixel (%d, %d) but it isn't set to 1 or 0", width, height);
-        return (u8)0;
+        if (keys & KEY_BIT(i)) return i;
     }
+    return (u8)-1;
 }
 
-u8 get_chip_key()
+u8 set_frame_keys(struct chip8 *state, u16 held, u16 pressed)
 {
-    for (u8 i = 0; i < 16; i++)
+    // A key tapped and let go since the last frame still counts as down for this one
+    state->keys = held | pressed;
+    if (!state->await_input) return (u8)-1;
+
+    u8 key = get_chip_key(pressed);
+    if (key != (u8)-1)
     {
-        if (pf_get_key_pressed(chip8_keys[i])) return i;
+        state->cpu.v[state->input_register] = key;
+        state->await_input = 0;
     }
-    return (u8)-1;
+    return key;
+}
+
+void seed_random(struct chip8 *state, u64 seed)
+{
+    // PCG32's own seeding, so nearby seeds still start far apart
+    state->random = 0;
+    next_random(state);
+    state->random += seed;
+    next_random(state);
+}
+
+u32 next_random(struct chip8 *state)
+{
+    // PCG32 XSH RR with a fixed increment, a 64 bit LCG with a permuted 32 bit output
+    u64 old = state->random;
+    state->random = old * 6364136223846793005ull + 1442695040888963407ull;
+    u32 shifted = (u32)(((old >> 18) ^ old) >> 27);
+    u32 rotate = (u32)(old >> 59);
+    return (shifted >> rotate) | (shifted << ((32 - rotate) & 31));
 }
 
 void print_memory(struct chip8 *state, int offset, int count, int vals_per_line)
@@ -3,12 +3,16 @@
 
 #include "types.h"
 
-#include <SDL_scancode.h>
-
 #define DISPLAY_WIDTH 64
 #define DISPLAY_HEIGHT 32
 #define DISPLAY_SIZE (DISPLAY_WIDTH * DISPLAY_HEIGHT)
 
+// Each screen row is packed into a u64, the leftmost pixel is the most significant bit
+#if DISPLAY_WIDTH != 64
+#error Screen rows are packed into 64 bit words
+#endif
+#define PIXEL_BIT(x) (0x8000000000000000ull >> (x))
+
 #define DISPLAY_SCALE 16
 #define WINDOW_WIDTH (DISPLAY_WIDTH * DISPLAY_SCALE)
 #define WINDOW_HEIGHT (DISPLAY_HEIGHT * DISPLAY_SCALE)
@@ -17,8 +21,7 @@
 #define STACK_SIZE 1024
 
 #define NUM_CHIP_KEYS 16
-
-extern int chip8_keys[NUM_CHIP_KEYS];
+#define KEY_BIT(key) ((u16)1 << ((key) & 0xF))
 
 struct cpu
 {
@@ -31,12 +34,24 @@ struct cpu
     u8 v[16];
 };
 
+struct instruction
+{
+    u16 instruction;
+    u8 i;
+    u8 x;
+    u8 y;
+    u8 N;
+    u8 NN;
+    u16 NNN;
+};
+
 struct chip8
 {
     struct cpu cpu;
 
     u8 memory[MEMORY_SIZE];
-    u8 screen[DISPLAY_SIZE];
+    u64 screen[DISPLAY_HEIGHT];
+    u8 screen_dirty; // Set when the screen changes, cleared by whoever shows it
 
     u8 stack[STACK_SIZE];
     u8 *sp;
@@ -45,32 +60,39 @@ struct chip8
     u8 halt;
     u8 await_input;
     u8 input_register;
-};
+    u16 keys; // Keypad keys down this frame, bit n is key n, set by the host between frames
+    u64 random; // PCG32 state for Cxnn, each machine has its own so runs are reproducible and threads don't share one
 
-struct instruction
-{
-    u16 instruction;
-    u8 i;
-    u8 x;
-    u8 y;
-    u8 N;
-    u8 NN;
-    u16 NNN;
+    // Predecoded instructions indexed by address, filled lazily as code runs
+    struct instruction decoded[MEMORY_SIZE];
+    u8 decoded_valid[MEMORY_SIZE];
+    u8 code_modified; // Set when the program writes over an address that has been decoded
 };
 
 // General
 void init_chip8(struct chip8 *state);
 void print_cpu(struct chip8 *state);
-u8 save_state(struct chip8 *state);
+u8 load_rom(struct chip8 *state, const char *path); // Returns 0 on failure
+u8 load_font(struct chip8 *state, const char *path); // Returns 0 on failure
+
+// Timers
+void tick_timers(struct chip8 *state); // Called at 60Hz
 
 // Screen
 void print_screen(struct chip8 *state);
+u8 get_pixel(struct chip8 *state, int width, int height);
 void set_pixel(struct chip8 *state, int width, int height);
 void clear_pixel(struct chip8 *state, int width, int height);
 u8 toggle_pixel(struct chip8 *state, int width, int height); // Returns the state of the pixel
+u64 hash_screen(struct chip8 *state); // FNV-1a hash of the framebuffer
 
 // Keys
-u8 get_chip_key();
+u8 get_chip_key(u16 keys); // Lowest numbered key in a keypad mask, 0xFF if there is none
+u8 set_frame_keys(struct chip8 *state, u16 held, u16 pressed); // Keypad for the next frame, returns the key that answered Fx0A or 0xFF
+
+// Random
+void seed_random(struct chip8 *state, u64 seed); // The same seed always gives the same numbers
+u32 next_random(struct chip8 *state);
 
 // Memory
 void print_memory(struct chip8 *state, int offset, int count, int vals_per_line);
@@ -0,0 +1,208 @@
+#include "dispatch.h"
+
+#include "chip8.h"
+#include "instructions.h"
+
+#include <stdio.h>
+
+// Handler for each opcode group, arguments are the NN, N and NNN fields as constants
+#define HANDLER_0(nn, n, nnn) ((nnn) == 0x000 ? H_HALT : (nnn) == 0x0E0 ? H_CLEAR_SCREEN : (nnn) == 0x0EE ? H_END_SUBROUTINE : H_HOST)
+#define HANDLER_1(nn, n, nnn) H_JUMP
+#define HANDLER_2(nn, n, nnn) H_START_SUBROUTINE
+#define HANDLER_3(nn, n, nnn) H_SKIP_VX_EQ_NN
+#define HANDLER_4(nn, n, nnn) H_SKIP_VX_NEQ_NN
+#define HANDLER_5(nn, n, nnn) ((n) == 0x0 ? H_SKIP_VX_EQ_VY : H_UNKNOWN)
+#define HANDLER_6(nn, n, nnn) H_SET_VX
+#define HANDLER_7(nn, n, nnn) H_ADD_VX
+#define HANDLER_8(nn, n, nnn) ( \
+    (n) == 0x0 ? H_SET_VX_VY : \
+    (n) == 0x1 ? H_OR_VX_VY : \
+    (n) == 0x2 ? H_AND_VX_VY : \
+    (n) == 0x3 ? H_XOR_VX_VY : \
+    (n) == 0x4 ? H_ADD_VX_VY : \
+    (n) == 0x5 ? H_SUB_VX_VY : \
+    (n) == 0x6 ? H_SHIFT_RIGHT : \
+    (n) == 0x7 ? H_SUB_VY_VX : \
+    (n) == 0xE ? H_SHIFT_LEFT : H_UNKNOWN)
+#define HANDLER_9(nn, n, nnn) ((n) == 0x0 ? H_SKIP_VX_NEQ_VY : H_UNKNOWN)
+#define HANDLER_A(nn, n, nnn) H_SET_I
+#define HANDLER_B(nn, n, nnn) H_JUMP_OFFSET
+#define HANDLER_C(nn, n, nnn) H_RANDOM
+#define HANDLER_D(nn, n, nnn) H_DISPLAY
+#define HANDLER_E(nn, n, nnn) ((nn) == 0x9E ? H_SKIP_VX_PRESSED : (nn) == 0xA1 ? H_SKIP_VX_NPRESSED : H_UNKNOWN)
+#define HANDLER_F(nn, n, nnn) ( \
+    (nn) == 0x07 ? H_SET_VX_DELAY : \
+    (nn) == 0x15 ? H_SET_DELAY_VX : \
+    (nn) == 0x18 ? H_SET_SOUND_VX : \
+    (nn) == 0x29 ? H_FONT_CHARACTER : \
+    (nn) == 0x33 ? H_BIN_TO_DEC : \
+    (nn) == 0x55 ? H_STORE : \
+    (nn) == 0x65 ? H_LOAD : \
+    (nn) == 0x1E ? H_ADD_I : \
+    (nn) == 0x0A ? H_GET_KEY : H_UNKNOWN)
+
+// Opcode 0xabcd
+#define ENTRY(a, b, c, d) { HANDLER_##a(0x##c##d, 0x##d, 0x##b##c##d), 0x##b, 0x##c, 0x##d, 0x##c##d, 0x##b##c##d }
+
+#define ROW(a, b, c) \
+    ENTRY(a, b, c, 0), ENTRY(a, b, c, 1), ENTRY(a, b, c, 2), ENTRY(a, b, c, 3), \
+    ENTRY(a, b, c, 4), ENTRY(a, b, c, 5), ENTRY(a, b, c, 6), ENTRY(a, b, c, 7), \
+    ENTRY(a, b, c, 8), ENTRY(a, b, c, 9), ENTRY(a, b, c, A), ENTRY(a, b, c, B), \
+    ENTRY(a, b, c, C), ENTRY(a, b, c, D), ENTRY(a, b, c, E), ENTRY(a, b, c, F)
+
+#define BLOCK(a, b) \
+    ROW(a, b, 0), ROW(a, b, 1), ROW(a, b, 2), ROW(a, b, 3), \
+    ROW(a, b, 4), ROW(a, b, 5), ROW(a, b, 6), ROW(a, b, 7), \
+    ROW(a, b, 8), ROW(a, b, 9), ROW(a, b, A), ROW(a, b, B), \
+    ROW(a, b, C), ROW(a, b, D), ROW(a, b, E), ROW(a, b, F)
+
+#define GROUP(a) \
+    BLOCK(a, 0), BLOCK(a, 1), BLOCK(a, 2), BLOCK(a, 3), \
+    BLOCK(a, 4), BLOCK(a, 5), BLOCK(a, 6), BLOCK(a, 7), \
+    BLOCK(a, 8), BLOCK(a, 9), BLOCK(a, A), BLOCK(a, B), \
+    BLOCK(a, C), BLOCK(a, D), BLOCK(a, E), BLOCK(a, F)
+
+const struct dispatch_entry dispatch_table[65536] = {
+    GROUP(0), GROUP(1), GROUP(2), GROUP(3),
+    GROUP(4), GROUP(5), GROUP(6), GROUP(7),
+    GROUP(8), GROUP(9), GROUP(A), GROUP(B),
+    GROUP(C), GROUP(D), GROUP(E), GROUP(F)
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define THREADED_DISPATCH
+#endif
+
+// Stop GCC merging the indirect jumps at the end of every handler back into one shared jump
+#if defined(__GNUC__) && !defined(__clang__)
+#define NO_JUMP_MERGING __attribute__((optimize("no-gcse", "no-crossjumping")))
+#else
+#define NO_JUMP_MERGING
+#endif
+
+// Fetches the next entry, stopping once count instructions have run
+#define FETCH() \
+    if (n >= count) goto done; \
+    e = &dispatch_table[((u16)state->memory[state->cpu.pc & (MEMORY_SIZE - 1)] << 8) | state->memory[(state->cpu.pc + 1) & (MEMORY_SIZE - 1)]]; \
+    state->cpu.pc += 2; \
+    n++;
+
+// Opcode of the instruction being executed, only needed for error messages
+#define OPCODE() (((u16)state->memory[(state->cpu.pc - 2) & (MEMORY_SIZE - 1)] << 8) | state->memory[(state->cpu.pc - 1) & (MEMORY_SIZE - 1)])
+
+#ifdef THREADED_DISPATCH
+#define OP(handler) op_##handler:
+#define NEXT() FETCH(); goto *labels[e->handler]
+#else
+#define OP(handler) case handler:
+#define NEXT() break
+#endif
+
+NO_JUMP_MERGING u64 run_threaded(struct chip8 *state, u64 count)
+{
+    u64 n = 0;
+    const struct dispatch_entry *e;
+
+    if (state->halt || state->await_input) return 0;
+
+#ifdef THREADED_DISPATCH
+    static void *labels[HANDLER_COUNT] = {
+        [H_HALT] = &&op_H_HALT,
+        [H_CLEAR_SCREEN] = &&op_H_CLEAR_SCREEN,
+        [H_END_SUBROUTINE] = &&op_H_END_SUBROUTINE,
+        [H_HOST] = &&op_H_HOST,
+        [H_JUMP] = &&op_H_JUMP,
+        [H_START_SUBROUTINE] = &&op_H_START_SUBROUTINE,
+        [H_SKIP_VX_EQ_NN] = &&op_H_SKIP_VX_EQ_NN,
+        [H_SKIP_VX_NEQ_NN] = &&op_H_SKIP_VX_NEQ_NN,
+        [H_SKIP_VX_EQ_VY] = &&op_H_SKIP_VX_EQ_VY,
+        [H_SET_VX] = &&op_H_SET_VX,
+        [H_ADD_VX] = &&op_H_ADD_VX,
+        [H_SET_VX_VY] = &&op_H_SET_VX_VY,
+        [H_OR_VX_VY] = &&op_H_OR_VX_VY,
+        [H_AND_VX_VY] = &&op_H_AND_VX_VY,
+        [H_XOR_VX_VY] = &&op_H_XOR_VX_VY,
+        [H_ADD_VX_VY] = &&op_H_ADD_VX_VY,
+        [H_SUB_VX_VY] = &&op_H_SUB_VX_VY,
+        [H_SHIFT_RIGHT] = &&op_H_SHIFT_RIGHT,
+        [H_SUB_VY_VX] = &&op_H_SUB_VY_VX,
+        [H_SHIFT_LEFT] = &&op_H_SHIFT_LEFT,
+        [H_SKIP_VX_NEQ_VY] = &&op_H_SKIP_VX_NEQ_VY,
+        [H_SET_I] = &&op_H_SET_I,
+        [H_JUMP_OFFSET] = &&op_H_JUMP_OFFSET,
+        [H_RANDOM] = &&op_H_RANDOM,
+        [H_DISPLAY] = &&op_H_DISPLAY,
+        [H_SKIP_VX_PRESSED] = &&op_H_SKIP_VX_PRESSED,
+        [H_SKIP_VX_NPRESSED] = &&op_H_SKIP_VX_NPRESSED,
+        [H_SET_VX_DELAY] = &&op_H_SET_VX_DELAY,
+        [H_SET_DELAY_VX] = &&op_H_SET_DELAY_VX,
+        [H_SET_SOUND_VX] = &&op_H_SET_SOUND_VX,
+        [H_FONT_CHARACTER] = &&op_H_FONT_CHARACTER,
+        [H_BIN_TO_DEC] = &&op_H_BIN_TO_DEC,
+        [H_STORE] = &&op_H_STORE,
+        [H_LOAD] = &&op_H_LOAD,
+        [H_ADD_I] = &&op_H_ADD_I,
+        [H_GET_KEY] = &&op_H_GET_KEY,
+        [H_UNKNOWN] = &&op_H_UNKNOWN,
+    };
+    NEXT();
+#else
+    for (;;)
+    {
+    FETCH();
+    switch(e->handler)
+    {
+#endif
+
+    OP(H_HALT) in_halt(state); goto done;
+    OP(H_CLEAR_SCREEN) in_clear_screen(state); NEXT();
+    OP(H_END_SUBROUTINE) in_end_subroutine(state); NEXT();
+    OP(H_HOST)
+        printf("Unknown host machine instruction: %#06x\n", OPCODE());
+        NEXT();
+    OP(H_JUMP) in_jump(state, e->NNN); NEXT();
+    OP(H_START_SUBROUTINE) in_start_subroutine(state, e->NNN); NEXT();
+    OP(H_SKIP_VX_EQ_NN) in_skip_vx_eq_nn(state, e->x, e->NN); NEXT();
+    OP(H_SKIP_VX_NEQ_NN) in_skip_vx_neq_nn(state, e->x, e->NN); NEXT();
+    OP(H_SKIP_VX_EQ_VY) in_skip_vx_eq_vy(state, e->x, e->y); NEXT();
+    OP(H_SET_VX) in_set_vx(state, e->x, e->NN); NEXT();
+    OP(H_ADD_VX) in_add_vx(state, e->x, e->NN); NEXT();
+    OP(H_SET_VX_VY) in_set_vx_vy(state, e->x, e->y); NEXT();
+    OP(H_OR_VX_VY) in_or_vx_vy(state, e->x, e->y); NEXT();
+    OP(H_AND_VX_VY) in_and_vx_vy(state, e->x, e->y); NEXT();
+    OP(H_XOR_VX_VY) in_xor_vx_vy(state, e->x, e->y); NEXT();
+    OP(H_ADD_VX_VY) in_add_vx_vy(state, e->x, e->y); NEXT();
+    OP(H_SUB_VX_VY) in_sub_vx_vy(state, e->x, e->y); NEXT();
+    OP(H_SHIFT_RIGHT) in_shift_right_modern(state, e->x, e->y); NEXT();
+    OP(H_SUB_VY_VX) in_sub_vy_vx(state, e->x, e->y); NEXT();
+    OP(H_SHIFT_LEFT) in_shift_left_modern(state, e->x, e->y); NEXT();
+    OP(H_SKIP_VX_NEQ_VY) in_skip_vx_neq_vy(state, e->x, e->y); NEXT();
+    OP(H_SET_I) in_set_i(state, e->NNN); NEXT();
+    OP(H_JUMP_OFFSET) in_jump_offset_classic(state, e->x, e->NNN); NEXT();
+    OP(H_RANDOM) in_random(state, e->x, e->NN); NEXT();
+    OP(H_DISPLAY) in_display(state, e->x, e->y, e->N); NEXT();
+    OP(H_SKIP_VX_PRESSED) in_skip_vx_pressed(state, e->x); NEXT();
+    OP(H_SKIP_VX_NPRESSED) in_skip_vx_npressed(state, e->x); NEXT();
+    OP(H_SET_VX_DELAY) in_set_vx_delay(state, e->x); NEXT();
+    OP(H_SET_DELAY_VX) in_set_delay_vx(state, e->x); NEXT();
+    OP(H_SET_SOUND_VX) in_set_sound_vx(state, e->x); NEXT();
+    OP(H_FONT_CHARACTER) in_font_character(state, e->x); NEXT();
+    OP(H_BIN_TO_DEC) in_bin_to_dec(state, e->x); NEXT();
+    OP(H_STORE) in_store_modern(state, e->x); NEXT();
+    OP(H_LOAD) in_load_modern(state, e->x); NEXT();
+    OP(H_ADD_I) in_add_i(state, e->x); NEXT();
+    OP(H_GET_KEY) in_get_key(state, e->x); goto done;
+    OP(H_UNKNOWN)
+        printf("Unknown instruction: %#06x\n", OPCODE());
+        state->halt = 1;
+        goto done;
+
+#ifndef THREADED_DISPATCH
+    }
+    }
+#endif
+
+done:
+    state->cycles += n;
+    return n;
+}
\ No newline at end of file
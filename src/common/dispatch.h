@@ -0,0 +1,75 @@
+#ifndef _DISPATCH_H_
+#define _DISPATCH_H_
+
+#include "types.h"
+
+/*
+Table driven interpreter
+
+Every 16 bit opcode has an entry in a 65536 entry table built by the preprocessor,
+holding the handler to run and its operands already extracted, so dispatch is a
+single table load instead of decoding and then branching on the opcode groups
+
+With GCC and Clang the handlers are direct threaded using computed goto,
+other compilers fall back to a switch over the handler index
+*/
+
+struct chip8;
+
+enum handler
+{
+    H_HALT,
+    H_CLEAR_SCREEN,
+    H_END_SUBROUTINE,
+    H_HOST,
+    H_JUMP,
+    H_START_SUBROUTINE,
+    H_SKIP_VX_EQ_NN,
+    H_SKIP_VX_NEQ_NN,
+    H_SKIP_VX_EQ_VY,
+    H_SET_VX,
+    H_ADD_VX,
+    H_SET_VX_VY,
+    H_OR_VX_VY,
+    H_AND_VX_VY,
+    H_XOR_VX_VY,
+    H_ADD_VX_VY,
+    H_SUB_VX_VY,
+    H_SHIFT_RIGHT,
+    H_SUB_VY_VX,
+    H_SHIFT_LEFT,
+    H_SKIP_VX_NEQ_VY,
+    H_SET_I,
+    H_JUMP_OFFSET,
+    H_RANDOM,
+    H_DISPLAY,
+    H_SKIP_VX_PRESSED,
+    H_SKIP_VX_NPRESSED,
+    H_SET_VX_DELAY,
+    H_SET_DELAY_VX,
+    H_SET_SOUND_VX,
+    H_FONT_CHARACTER,
+    H_BIN_TO_DEC,
+    H_STORE,
+    H_LOAD,
+    H_ADD_I,
+    H_GET_KEY,
+    H_UNKNOWN,
+    HANDLER_COUNT
+};
+
+struct dispatch_entry
+{
+    u8 handler;
+    u8 x;
+    u8 y;
+    u8 N;
+    u8 NN;
+    u16 NNN;
+};
+
+extern const struct dispatch_entry dispatch_table[65536];
+
+u64 run_threaded(struct chip8 *state, u64 count); // Runs until count, halt or awaiting input, returns instructions run
+
+#endif //_DISPATCH_H_
\ No newline at end of file
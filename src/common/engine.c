@@ -0,0 +1,79 @@
+#include "engine.h"
+
+#include "chip8.h"
+#include "instructions.h"
+#include "dispatch.h"
+#include "jit.h"
+#include "aot.h"
+#include "fusion.h"
+#include "idle.h"
+
+#include <string.h>
+
+const char *engine_names[ENGINE_COUNT] = {
+    "uncached",
+    "switch",
+    "threaded",
+    "jit",
+    "aot",
+    "fused",
+};
+
+u8 parse_engine(const char *name, enum engine *engine)
+{
+    for (int i = 0; i < ENGINE_COUNT; i++)
+    {
+        if (strcmp(name, engine_names[i]) == 0)
+        {
+            *engine = (enum engine)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static u8 skip_idle;
+
+void set_idle_skip(u8 enabled)
+{
+    skip_idle = enabled;
+}
+
+static u64 dispatch_engine(struct chip8 *state, enum engine engine, u64 count)
+{
+    switch(engine)
+    {
+    case ENGINE_UNCACHED:
+        return run_uncached(state, count);
+    case ENGINE_SWITCH:
+        return run_instructions(state, count);
+    case ENGINE_THREADED:
+        return run_threaded(state, count);
+    case ENGINE_JIT:
+        return jit_run(state, count);
+    case ENGINE_AOT:
+        return aot_run(state, count);
+    case ENGINE_FUSED:
+        return run_fused(state, count);
+    default:
+        return 0;
+    }
+}
+
+u64 run_engine(struct chip8 *state, enum engine engine, u64 count)
+{
+    if (!skip_idle) return dispatch_engine(state, engine, count);
+
+    // Look for an idle loop at the start of the batch, where the last one stopped, and then
+    // every IDLE_CHECK_INTERVAL instructions wherever the engine stopped
+    u64 n = 0;
+    while (n < count && !state->halt && !state->await_input)
+    {
+        n += idle_skip(state, count - n);
+        if (n >= count || state->halt || state->await_input) break;
+
+        u64 slice = count - n < IDLE_CHECK_INTERVAL ? count - n : IDLE_CHECK_INTERVAL;
+        n += dispatch_engine(state, engine, slice);
+    }
+    return n;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef _ENGINE_H_
+#define _ENGINE_H_
+
+#include "types.h"
+
+/*
+Execution engines
+
+All engines have the same semantics as calling execute_instruction in a loop,
+they only differ in how instructions are fetched and dispatched
+
+uncached: fetch_instruction, decode_instruction and execute_instruction every tick
+switch: predecoded cache dispatched through execute_instruction
+threaded: opcode table with direct threaded handlers
+jit: x86-64 basic block translation, same as threaded on other hosts
+aot: blocks from a rom compiled by c8aot and loaded with aot_load, interpreting anything else
+fused: switch with common instruction sequences run as single superinstructions
+
+With idle skipping on, run_engine stops the engine every IDLE_CHECK_INTERVAL instructions
+to look for a loop that is only waiting for the next frame, see idle.h
+*/
+
+#define IDLE_CHECK_INTERVAL 1024
+
+struct chip8;
+
+enum engine
+{
+    ENGINE_UNCACHED,
+    ENGINE_SWITCH,
+    ENGINE_THREADED,
+    ENGINE_JIT,
+    ENGINE_AOT,
+    ENGINE_FUSED,
+    ENGINE_COUNT
+};
+
+extern const char *engine_names[ENGINE_COUNT];
+
+u8 parse_engine(const char *name, enum engine *engine); // Returns 0 if the name isn't an engine
+u64 run_engine(struct chip8 *state, enum engine engine, u64 count); // Runs until count, halt or awaiting input, returns instructions run
+void set_idle_skip(u8 enabled); // Off by default
+
+#endif //_ENGINE_H_
\ No newline at end of file
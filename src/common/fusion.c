@@ -0,0 +1,227 @@
+#include "fusion.h"
+
+#include "chip8.h"
+#include "instructions.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+const char *fusion_names[FUSION_COUNT] = {
+    "none",
+    "Annn Dxyn",
+    "Annn Fx65",
+    "3xNN/4xNN 1nnn",
+    "6xNN run",
+    "Fx07 3x00 1nnn",
+};
+
+struct fusion_state
+{
+    struct chip8 *owner;
+    u8 kind[MEMORY_SIZE]; // FUSE_UNANALYSED until the address first runs
+    u8 length[MEMORY_SIZE]; // Instructions covered by the fused sequence at an address
+
+    u64 fired[FUSION_COUNT];
+    u64 covered[FUSION_COUNT]; // Instructions run inside fused sequences
+    u64 total; // Every instruction run by run_fused
+};
+
+#define FUSE_UNANALYSED 0xFF
+
+static struct fusion_state fusion;
+
+void fusion_flush()
+{
+    memset(fusion.kind, FUSE_UNANALYSED, sizeof(fusion.kind));
+    fusion.owner = NULL;
+}
+
+void fusion_reset_report()
+{
+    memset(fusion.fired, 0, sizeof(fusion.fired));
+    memset(fusion.covered, 0, sizeof(fusion.covered));
+    fusion.total = 0;
+}
+
+void print_fusion_report()
+{
+    printf("Fusion report:\n");
+    for (int kind = FUSE_NONE + 1; kind < FUSION_COUNT; kind++)
+    {
+        f64 share = fusion.total ? 100.0 * fusion.covered[kind] / fusion.total : 0.0;
+        printf("  %-16s fired %12" PRIu64 " times, %12" PRIu64 " instructions (%5.1f%%)\n", fusion_names[kind], fusion.fired[kind], fusion.covered[kind], share);
+    }
+}
+
+// Decoded instruction at address through the predecoded cache, so later writes to it raise code_modified
+static struct instruction *decoded_at(struct chip8 *state, u16 address)
+{
+    struct instruction *instruction = &state->decoded[address];
+    if (!state->decoded_valid[address])
+    {
+        u16 instruction_bytes = ((u16)state->memory[address] << 8) + (u16)state->memory[address + 1];
+        decode_instruction(instruction_bytes, instruction);
+        state->decoded_valid[address] = 1;
+    }
+    return instruction;
+}
+
+static void analyse(struct chip8 *state, u16 address)
+{
+    fusion.kind[address] = FUSE_NONE;
+    fusion.length[address] = 1;
+
+    // Always decoded, run_fused runs unfused instructions straight from the cache
+    struct instruction *a = decoded_at(state, address);
+
+    // Longest sequence is FUSION_MAX_SET_RUN instructions, keep every piece inside memory
+    int available = (MEMORY_SIZE - address) / 2;
+    if (available < 2) return;
+
+    // Only look past instructions that can start a sequence, the bytes after anything else may well be data
+    if (a->i != 0x3 && a->i != 0x4 && a->i != 0x6 && a->i != 0xA && !(a->i == 0xF && a->NN == 0x07)) return;
+    struct instruction *b = decoded_at(state, address + 2);
+
+    if (a->i == 0xF && a->NN == 0x07 && available >= 3)
+    {
+        struct instruction *c = decoded_at(state, address + 4);
+        if (b->i == 0x3 && b->x == a->x && b->NN == 0x00 && c->i == 0x1)
+        {
+            fusion.kind[address] = FUSE_DELAY_WAIT;
+            fusion.length[address] = 3;
+            return;
+        }
+    }
+
+    if (a->i == 0xA && b->i == 0xD)
+    {
+        fusion.kind[address] = FUSE_SET_I_DISPLAY;
+        fusion.length[address] = 2;
+    }
+    else if (a->i == 0xA && b->i == 0xF && b->NN == 0x65)
+    {
+        fusion.kind[address] = FUSE_SET_I_LOAD;
+        fusion.length[address] = 2;
+    }
+    else if ((a->i == 0x3 || a->i == 0x4) && b->i == 0x1)
+    {
+        fusion.kind[address] = FUSE_SKIP_JUMP;
+        fusion.length[address] = 2;
+    }
+    else if (a->i == 0x6 && b->i == 0x6)
+    {
+        int length = 2;
+        while (length < FUSION_MAX_SET_RUN && length < available && decoded_at(state, address + 2 * length)->i == 0x6)
+        {
+            length++;
+        }
+        fusion.kind[address] = FUSE_SET_VX_RUN;
+        fusion.length[address] = (u8)length;
+    }
+}
+
+// Runs the fused sequence at pc, which has already been analysed, returns instructions run
+static u8 run_sequence(struct chip8 *state, u16 address, u8 kind, u8 length)
+{
+    struct instruction *a = &state->decoded[address];
+    struct instruction *b = &state->decoded[address + 2];
+
+    switch(kind)
+    {
+    case FUSE_SET_I_DISPLAY:
+        state->cpu.pc = address + 4;
+        in_set_i(state, a->NNN);
+        in_display(state, b->x, b->y, b->N);
+        return 2;
+    case FUSE_SET_I_LOAD:
+        state->cpu.pc = address + 4;
+        in_set_i(state, a->NNN);
+        in_load_modern(state, b->x);
+        return 2;
+    case FUSE_SKIP_JUMP:
+        // A skipped jump never runs so it doesn't count
+        if ((state->cpu.v[a->x] == a->NN) == (a->i == 0x3))
+        {
+            state->cpu.pc = address + 4;
+            return 1;
+        }
+        state->cpu.pc = b->NNN;
+        return 2;
+    case FUSE_SET_VX_RUN:
+        for (int n = 0; n < length; n++)
+        {
+            struct instruction *set = &state->decoded[address + 2 * n];
+            state->cpu.v[set->x] = set->NN;
+        }
+        state->cpu.pc = address + 2 * length;
+        return length;
+    case FUSE_DELAY_WAIT:
+        state->cpu.v[a->x] = state->cpu.delay;
+        if (state->cpu.delay == 0)
+        {
+            state->cpu.pc = address + 6;
+            return 2;
+        }
+        state->cpu.pc = state->decoded[address + 4].NNN;
+        return 3;
+    }
+    return 0;
+}
+
+u64 run_fused(struct chip8 *state, u64 count)
+{
+    if (fusion.owner != state)
+    {
+        fusion_flush();
+        fusion.owner = state;
+    }
+
+    u64 n = 0;
+    while (n < count && !state->halt && !state->await_input)
+    {
+        if (state->code_modified)
+        {
+            // Something wrote over decoded code, find every sequence again
+            memset(fusion.kind, FUSE_UNANALYSED, sizeof(fusion.kind));
+            state->code_modified = 0;
+        }
+
+        u16 pc = state->cpu.pc;
+        struct instruction *instruction;
+        if (pc < MEMORY_SIZE - 1)
+        {
+            u8 kind = fusion.kind[pc];
+            if (kind == FUSE_UNANALYSED)
+            {
+                analyse(state, pc);
+                kind = fusion.kind[pc];
+            }
+
+            if (kind != FUSE_NONE && fusion.length[pc] <= count - n)
+            {
+                u8 ran = run_sequence(state, pc, kind, fusion.length[pc]);
+                fusion.fired[kind]++;
+                fusion.covered[kind] += ran;
+                n += ran;
+                continue;
+            }
+
+            instruction = &state->decoded[pc];
+            state->cpu.pc += 2;
+        }
+        else
+        {
+            instruction = fetch_decoded(state);
+        }
+
+        if (!execute_instruction(state, instruction))
+        {
+            state->halt = 1;
+        }
+        n++;
+    }
+    state->cycles += n;
+    fusion.total += n;
+    return n;
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef _FUSION_H_
+#define _FUSION_H_
+
+#include "types.h"
+
+/*
+Superinstruction fusion
+
+The fused engine is the switch engine with a pass over the predecoded cache that
+recognises common instruction sequences and runs each one as a single handler
+
+Annn Dxyn        set I then draw
+Annn Fx65        set I then load registers
+3xNN/4xNN 1nnn   skip guarding a jump
+6xNN 6xNN ...    runs of register sets, up to FUSION_MAX_SET_RUN long
+Fx07 3x00 1nnn   delay timer wait loop
+
+A fused handler has exactly the semantics of running its pieces one at a time through
+execute_instruction, and only runs when the budget covers every piece of it
+
+Every piece of a fused sequence is marked in the predecoded cache, so a write to any of
+them raises code_modified and the sequences are found again before anything else runs
+
+Like the JIT the analysis is kept for one struct chip8 at a time
+*/
+
+#define FUSION_MAX_SET_RUN 8
+
+struct chip8;
+
+enum fusion
+{
+    FUSE_NONE,
+    FUSE_SET_I_DISPLAY,
+    FUSE_SET_I_LOAD,
+    FUSE_SKIP_JUMP,
+    FUSE_SET_VX_RUN,
+    FUSE_DELAY_WAIT,
+    FUSION_COUNT
+};
+
+extern const char *fusion_names[FUSION_COUNT];
+
+u64 run_fused(struct chip8 *state, u64 count); // Runs until count, halt or awaiting input, returns instructions run
+void fusion_flush();
+void print_fusion_report(); // How often each fusion ran since the last fusion_reset_report
+void fusion_reset_report();
+
+#endif //_FUSION_H_
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "idle.h"
+
+#include "chip8.h"
+#include "instructions.h"
+
+#include <stdio.h>
+#include <string.h>
+
+struct idle_state
+{
+    // Stats
+    u64 searches;
+    u64 loops_found;
+    u64 stepped; // Instructions run while searching
+    u64 skipped; // Instructions accounted for without running them
+};
+
+static struct idle_state idle;
+
+void idle_reset_report()
+{
+    memset(&idle, 0, sizeof(idle));
+}
+
+void print_idle_report()
+{
+    u64 total = idle.stepped + idle.skipped;
+    f64 share = total ? 100.0 * idle.skipped / total : 0.0;
+    printf("Idle report:\n");
+    printf("  searches %12" PRIu64 ", idle loops found %12" PRIu64 "\n", idle.searches, idle.loops_found);
+    printf("  stepped  %12" PRIu64 ", skipped %12" PRIu64 " instructions (%5.1f%% of those seen)\n", idle.stepped, idle.skipped, share);
+}
+
+// Whether an instruction only reads and writes registers, with no effect outside struct cpu
+static u8 register_only(struct instruction *instruction)
+{
+    switch(instruction->i)
+    {
+    case 0x1: // Jump
+    case 0x3: // Skips on registers
+    case 0x4:
+    case 0x6: // Register arithmetic
+    case 0x7:
+    case 0xA: // Set I
+    case 0xB: // Jump with offset
+        return 1;
+    case 0x5:
+    case 0x9:
+        return instruction->N == 0;
+    case 0x8:
+        return instruction->N <= 0x7 || instruction->N == 0xE;
+    case 0xE:
+        return instruction->NN == 0x9E || instruction->NN == 0xA1; // Keys only change between frames
+    case 0xF:
+        return instruction->NN == 0x07 || instruction->NN == 0x1E || instruction->NN == 0x29;
+    default:
+        return 0;
+    }
+}
+
+u64 idle_skip(struct chip8 *state, u64 count)
+{
+    idle.searches++;
+
+    struct cpu start = state->cpu;
+    u64 since_start = 0;
+    u8 restarts = 0;
+    u64 n = 0;
+    u64 skip = 0;
+    while (n < count)
+    {
+        struct instruction *instruction = fetch_decoded(state);
+        if (!register_only(instruction))
+        {
+            state->cpu.pc -= 2; // Leave it for the engine
+            break;
+        }
+        execute_instruction(state, instruction);
+        n++;
+        since_start++;
+
+        if (state->cpu.pc == start.pc)
+        {
+            if (memcmp(&state->cpu, &start, sizeof(start)) == 0)
+            {
+                // Every pass from here is this one again, skip whole passes and leave the rest to the engine
+                skip = (count - n) / since_start * since_start;
+                idle.loops_found++;
+                idle.skipped += skip;
+                n += skip;
+                break;
+            }
+
+            // The first pass usually loads the registers the loop compares, try once more from here
+            if (++restarts > 2) break;
+            start = state->cpu;
+            since_start = 0;
+        }
+        else if (since_start >= IDLE_MAX_LOOP)
+        {
+            break;
+        }
+    }
+
+    idle.stepped += n - skip;
+    state->cycles += n;
+    return n;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#ifndef _IDLE_H_
+#define _IDLE_H_
+
+#include "types.h"
+
+/*
+Idle loop skipping
+
+Most roms wait for the delay timer or a key by spinning in a loop like Fx07 3x00 1nnn or
+a 1nnn jumping to itself. Nothing such a loop reads can change until the frame ends,
+timers only tick and keys are only polled between run_engine calls, so once one pass
+around the loop comes back to the same pc with every register unchanged, every pass
+after it is the same and the rest of the budget can be accounted for without running it
+
+idle_skip steps instructions from pc looking for that repeat. It only steps through
+instructions that read and write registers, anything that touches memory, the screen,
+the stack, the timers or the random number generator ends the search before it runs,
+so a loop containing one of them is never skipped
+
+Skipping lands on exactly the state running the loop would have, the same pc inside the
+loop, the same registers and the same cycle count, only without the host work
+*/
+
+#define IDLE_MAX_LOOP 16 // Longest loop, in instructions, that is looked for
+
+struct chip8;
+
+u64 idle_skip(struct chip8 *state, u64 count); // Runs register only instructions from pc and skips the rest of count if they loop, returns instructions run or skipped
+void print_idle_report();
+void idle_reset_report();
+
+#endif //_IDLE_H_
\ No newline at end of file
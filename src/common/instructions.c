@@ -1,9 +1,9 @@
 #include "instructions.h"
 
 #include "chip8.h"
-#include "platform.h"
 
 #include <stdio.h>
+#include <string.h>
 
 void fetch_instruction(struct chip8 *state, u16 *instruction)
 {
@@ -24,6 +24,82 @@ void decode_instruction(u16 instruction_bytes, struct instruction *instruction)
     instruction->NNN = (instruction_bytes) & 0xFFF;
 }
 
+struct instruction *fetch_decoded(struct chip8 *state)
+{
+    u16 pc = state->cpu.pc;
+    struct instruction *instruction = &state->decoded[pc & (MEMORY_SIZE - 1)];
+    if (pc >= MEMORY_SIZE - 1)
+    {
+        // The instruction runs off the end of memory, decode it wrapped around without caching it
+        u16 instruction_bytes = ((u16)state->memory[pc & (MEMORY_SIZE - 1)] << 8) + (u16)state->memory[(pc + 1) & (MEMORY_SIZE - 1)];
+        decode_instruction(instruction_bytes, instruction);
+        state->decoded_valid[pc & (MEMORY_SIZE - 1)] = 0;
+        state->cpu.pc += 2;
+        return instruction;
+    }
+    if (!state->decoded_valid[pc])
+    {
+        u16 instruction_bytes = ((u16)state->memory[pc] << 8) + (u16)state->memory[pc + 1];
+        decode_instruction(instruction_bytes, instruction);
+        state->decoded_valid[pc] = 1;
+    }
+    state->cpu.pc += 2;
+    return instruction;
+}
+
+void invalidate_decoded(struct chip8 *state, u16 address, u16 count)
+{
+    // An instruction starting one byte before the write also contains the first written byte
+    int start = (int)address - 1;
+    int end = (int)address + (int)count;
+    if (start < 0) start = 0;
+    if (end > MEMORY_SIZE) end = MEMORY_SIZE;
+
+    for (int a = start; a < end; a++)
+    {
+        if (state->decoded_valid[a])
+        {
+            state->decoded_valid[a] = 0;
+            state->code_modified = 1;
+        }
+    }
+}
+
+u64 run_instructions(struct chip8 *state, u64 count)
+{
+    u64 n = 0;
+    while (n < count && !state->halt && !state->await_input)
+    {
+        struct instruction *instruction = fetch_decoded(state);
+        if (!execute_instruction(state, instruction))
+        {
+            state->halt = 1;
+        }
+        n++;
+    }
+    state->cycles += n;
+    return n;
+}
+
+u64 run_uncached(struct chip8 *state, u64 count)
+{
+    u64 n = 0;
+    u16 instruction_bytes;
+    struct instruction instruction;
+    while (n < count && !state->halt && !state->await_input)
+    {
+        fetch_instruction(state, &instruction_bytes);
+        decode_instruction(instruction_bytes, &instruction);
+        if (!execute_instruction(state, &instruction))
+        {
+            state->halt = 1;
+        }
+        n++;
+    }
+    state->cycles += n;
+    return n;
+}
+
 u8 execute_instruction(struct chip8 *state, struct instruction *instruction)
 {
     switch(instruction->i)
@@ -351,7 +427,8 @@ u8 debug_instruction(struct chip8 *state, struct instruction *instruction)
 
 void in_clear_screen(struct chip8 *state)
 {
-    memset(state->screen, 0, DISPLAY_SIZE);
+    memset(state->screen, 0, sizeof(state->screen));
+    state->screen_dirty = 1;
 }
 
 void in_jump(struct chip8 *state, u16 address)
@@ -378,22 +455,24 @@ void in_display(struct chip8 *state, u8 xreg, u8 yreg, u8 height)
 {
     u8 x = state->cpu.v[xreg] % DISPLAY_WIDTH;
     u8 y = state->cpu.v[yreg] % DISPLAY_HEIGHT;
-    state->cpu.v[0xF] = 0;
+    u64 collision = 0;
+    u64 drawn = 0;
+
+    // Sprites are clipped at the bottom edge
+    int rows = height;
+    if (y + rows > DISPLAY_HEIGHT) rows = DISPLAY_HEIGHT - y;
 
-    for (int row = 0; row < height; row++)
+    for (int row = 0; row < rows; row++)
     {
-        u8 row_data = state->memory[state->cpu.i + row];
-        for (int bit = 0; bit < 8; bit++)
-        {
-            u8 should_toggle = (row_data >> (7 - bit)) & 0x1;
-            if (should_toggle && x + bit < DISPLAY_WIDTH && y + row < DISPLAY_HEIGHT)
-            {
-                u8 pixel = toggle_pixel(state, x + bit, y + row);
-                if (pixel == 0)
-                    state->cpu.v[0xF] = 1;
-            }
-        }
+        // Line the sprite row up with column x, bits past the right edge are shifted out
+        u64 sprite = ((u64)state->memory[state->cpu.i + row] << 56) >> x;
+        u64 *line = &state->screen[y + row];
+        collision |= *line & sprite; // Any pixel turned off
+        drawn |= sprite;
+        *line ^= sprite;
     }
+    state->cpu.v[0xF] = collision != 0;
+    if (drawn) state->screen_dirty = 1;
 }
 
 void in_start_subroutine(struct chip8 *state, u16 address)
@@ -535,6 +614,7 @@ void in_store_modern(struct chip8 *state, u8 xreg)
     {
         state->memory[state->cpu.i + reg] = state->cpu.v[reg];
     }
+    invalidate_decoded(state, state->cpu.i, xreg + 1);
 }
 
 void in_load_modern(struct chip8 *state, u8 xreg)
@@ -569,16 +649,17 @@ void in_bin_to_dec(struct chip8 *state, u8 xreg)
     state->memory[state->cpu.i    ] = a;
     state->memory[state->cpu.i + 1] = b;
     state->memory[state->cpu.i + 2] = c;
+    invalidate_decoded(state, state->cpu.i, 3);
 }
 
 void in_random(struct chip8 *state, u8 xreg, u8 nn)
 {
-    state->cpu.v[xreg] = (pf_rand() % 256) & nn;
+    state->cpu.v[xreg] = (u8)(next_random(state) >> 24) & nn; // The top bits are the best mixed
 }
 
 void in_skip_vx_pressed(struct chip8 *state, u8 xreg)
 {
-    if (pf_get_key_held(chip8_keys[state->cpu.v[xreg]]))
+    if (state->keys & KEY_BIT(state->cpu.v[xreg]))
     {
         state->cpu.pc += 2;
     }
@@ -586,7 +667,7 @@ void in_skip_vx_pressed(struct chip8 *state, u8 xreg)
 
 void in_skip_vx_npressed(struct chip8 *state, u8 xreg)
 {
-    if (!pf_get_key_held(chip8_keys[state->cpu.v[xreg]]))
+    if (!(state->keys & KEY_BIT(state->cpu.v[xreg])))
     {
         state->cpu.pc += 2;
     }
@@ -20,6 +20,20 @@ void fetch_instruction(struct chip8 *state, u16 *instruction);
 void decode_instruction(u16 instruction_bytes, struct instruction *instruction);
 u8 execute_instruction(struct chip8 *state, struct instruction *instruction); // Returns whether or not instruction was known
 
+/*
+Predecoded instruction cache
+
+fetch_decoded returns the decoded instruction at pc from the cache in struct chip8,
+decoding it on first use, and advances pc like fetch_instruction
+
+Instructions that write to memory call invalidate_decoded so self modifying code
+is decoded again the next time it runs
+*/
+struct instruction *fetch_decoded(struct chip8 *state);
+void invalidate_decoded(struct chip8 *state, u16 address, u16 count);
+u64 run_instructions(struct chip8 *state, u64 count); // Runs until count, halt or awaiting input, returns instructions run
+u64 run_uncached(struct chip8 *state, u64 count); // Same as run_instructions but fetches and decodes every instruction
+
 u8 debug_instruction(struct chip8 *state, struct instruction *instruction); // Returns whether or not instruction was known
 
 void in_clear_screen(struct chip8 *state);
@@ -0,0 +1,676 @@
+#include "jit.h"
+
+#include "chip8.h"
+#include "instructions.h"
+#include "dispatch.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define JIT_CODE_SIZE (1 << 20)
+#define JIT_MAX_BLOCK_BYTES 8192 // Worst case native code for one block
+#define JIT_MAX_BLOCKS 8192
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define JIT_HOST_REGISTERS 5
+
+// Host registers
+#define RAX 0
+#define RCX 1
+#define RBX 3
+#define RBP 5
+#define R12 12
+#define R13 13
+#define R14 14
+#define R15 15
+
+// Callee saved registers that can hold V registers for a whole block, rbx holds state
+static const int host_registers[JIT_HOST_REGISTERS] = { RBP, R12, R13, R14, R15 };
+
+#define OFF_V(x) ((int)(offsetof(struct chip8, cpu.v) + (x)))
+#define OFF_PC ((int)offsetof(struct chip8, cpu.pc))
+#define OFF_I ((int)offsetof(struct chip8, cpu.i))
+#define OFF_DELAY ((int)offsetof(struct chip8, cpu.delay))
+#define OFF_SOUND ((int)offsetof(struct chip8, cpu.sound))
+
+typedef void (*block_code)(struct chip8 *state);
+
+struct jit_block
+{
+    block_code code;
+    u16 length; // Instructions in the block, 0 if the first instruction can't be translated
+};
+
+struct jit_state
+{
+    u8 unavailable;
+    u8 *code;
+    u32 code_used;
+    struct chip8 *owner;
+    struct jit_block blocks[JIT_MAX_BLOCKS];
+    u32 block_count;
+    struct jit_block *lookup[MEMORY_SIZE];
+};
+
+static struct jit_state jit;
+
+enum jit_kind
+{
+    KIND_UNKNOWN, // Left to the interpreter
+    KIND_NATIVE,
+    KIND_HELPER,
+    KIND_END_NATIVE, // Jumps and skips, written out in the block epilogue
+    KIND_END_HELPER,
+};
+
+// Register or [rbx + disp]
+struct operand
+{
+    int reg; // -1 for memory
+    int disp;
+};
+
+struct translation
+{
+    u8 *p;
+    int host[16]; // Host register holding V[x], -1 if it lives in struct chip8
+    int saved; // Number of host_registers in use
+};
+
+static void emit8(struct translation *t, u8 byte)
+{
+    *t->p++ = byte;
+}
+
+static void emit16(struct translation *t, u16 value)
+{
+    emit8(t, value & 0xFF);
+    emit8(t, (value >> 8) & 0xFF);
+}
+
+static void emit32(struct translation *t, u32 value)
+{
+    emit16(t, value & 0xFFFF);
+    emit16(t, (value >> 16) & 0xFFFF);
+}
+
+static void emit64(struct translation *t, u64 value)
+{
+    emit32(t, (u32)value);
+    emit32(t, (u32)(value >> 32));
+}
+
+static struct operand memory_operand(int disp)
+{
+    struct operand op = { -1, disp };
+    return op;
+}
+
+static struct operand register_operand(int reg)
+{
+    struct operand op = { reg, 0 };
+    return op;
+}
+
+static struct operand v_operand(struct translation *t, u8 x)
+{
+    struct operand op = { t->host[x], OFF_V(x) };
+    return op;
+}
+
+// Byte sized op, opcodes above 0xFF are 0x0F prefixed, reg is a register or a /digit opcode extension
+static void emit_rm8(struct translation *t, u16 opcode, int reg, u8 reg_is_register, struct operand rm)
+{
+    u8 rex = 0;
+    if (reg_is_register && reg >= 4) rex |= 0x40; // Selects spl-dil rather than ah-bh
+    if (reg_is_register && reg >= 8) rex |= 0x04;
+    if (rm.reg >= 4) rex |= 0x40;
+    if (rm.reg >= 8) rex |= 0x01;
+    if (rex) emit8(t, rex);
+
+    if (opcode > 0xFF) emit8(t, (opcode >> 8) & 0xFF);
+    emit8(t, opcode & 0xFF);
+
+    if (rm.reg >= 0)
+    {
+        emit8(t, 0xC0 | ((reg & 7) << 3) | (rm.reg & 7));
+    }
+    else
+    {
+        emit8(t, 0x80 | ((reg & 7) << 3) | RBX);
+        emit32(t, (u32)rm.disp);
+    }
+}
+
+// Word sized op on [rbx + disp]
+static void emit_mem16(struct translation *t, u8 opcode, int reg, int disp)
+{
+    emit8(t, 0x66);
+    emit8(t, opcode);
+    emit8(t, 0x80 | ((reg & 7) << 3) | RBX);
+    emit32(t, (u32)disp);
+}
+
+static void emit_store_pc(struct translation *t, u16 pc)
+{
+    emit_mem16(t, 0xC7, 0, OFF_PC);
+    emit16(t, pc);
+}
+
+static void emit_write_back(struct translation *t)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        if (t->host[x] >= 0) emit_rm8(t, 0x88, t->host[x], 1, memory_operand(OFF_V(x)));
+    }
+}
+
+static void emit_reload(struct translation *t)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        if (t->host[x] >= 0) emit_rm8(t, 0x8A, t->host[x], 1, memory_operand(OFF_V(x)));
+    }
+}
+
+static void emit_push(struct translation *t, int reg)
+{
+    if (reg >= 8) emit8(t, 0x41);
+    emit8(t, 0x50 | (reg & 7));
+}
+
+static void emit_pop(struct translation *t, int reg)
+{
+    if (reg >= 8) emit8(t, 0x41);
+    emit8(t, 0x58 | (reg & 7));
+}
+
+// Only rbx and the host registers given to V registers are saved
+static void emit_prologue(struct translation *t)
+{
+    emit_push(t, RBX);
+    for (int r = 0; r < t->saved; r++) emit_push(t, host_registers[r]);
+    if (t->saved % 2 == 1)
+    {
+        emit8(t, 0x48); emit8(t, 0x83); emit8(t, 0xEC); emit8(t, 0x08); // sub rsp, 8 (keep calls 16 byte aligned)
+    }
+    emit8(t, 0x48); emit8(t, 0x89); emit8(t, 0xFB); // mov rbx, rdi
+    emit_reload(t);
+}
+
+static void emit_epilogue(struct translation *t)
+{
+    if (t->saved % 2 == 1)
+    {
+        emit8(t, 0x48); emit8(t, 0x83); emit8(t, 0xC4); emit8(t, 0x08); // add rsp, 8
+    }
+    for (int r = t->saved - 1; r >= 0; r--) emit_pop(t, host_registers[r]);
+    emit_pop(t, RBX);
+    emit8(t, 0xC3); // ret
+}
+
+// Calls fn(state, a, b, c) with pc set to the address after the instruction
+static void emit_call(struct translation *t, void *fn, u16 next_pc, int argc, u32 a, u32 b, u32 c)
+{
+    emit_write_back(t);
+    emit_store_pc(t, next_pc);
+    emit8(t, 0x48); emit8(t, 0x89); emit8(t, 0xDF); // mov rdi, rbx
+    if (argc >= 1) { emit8(t, 0xBE); emit32(t, a); } // mov esi, a
+    if (argc >= 2) { emit8(t, 0xBA); emit32(t, b); } // mov edx, b
+    if (argc >= 3) { emit8(t, 0xB9); emit32(t, c); } // mov ecx, c
+    emit8(t, 0x48); emit8(t, 0xB8); emit64(t, (u64)(size_t)fn); // mov rax, fn
+    emit8(t, 0xFF); emit8(t, 0xD0); // call rax
+    emit_reload(t);
+}
+
+// Runs any instruction through the interpreter
+static void jit_execute(struct chip8 *state, u32 opcode)
+{
+    struct instruction instruction;
+    decode_instruction((u16)opcode, &instruction);
+    execute_instruction(state, &instruction);
+}
+
+static enum jit_kind classify(struct instruction *in)
+{
+    switch(in->i)
+    {
+    case 0x0:
+        if (in->NNN == 0x000 || in->NNN == 0x0EE) return KIND_END_HELPER;
+        return KIND_HELPER;
+    case 0x1:
+        return KIND_END_NATIVE;
+    case 0x2:
+        return KIND_END_HELPER;
+    case 0x3:
+    case 0x4:
+        return KIND_END_NATIVE;
+    case 0x5:
+    case 0x9:
+        return in->N == 0 ? KIND_END_NATIVE : KIND_UNKNOWN;
+    case 0x6:
+    case 0x7:
+    case 0xA:
+        return KIND_NATIVE;
+    case 0x8:
+        if (in->N <= 0x7 || in->N == 0xE) return KIND_NATIVE;
+        return KIND_UNKNOWN;
+    case 0xB:
+    case 0xD:
+        return KIND_END_HELPER;
+    case 0xC:
+        return KIND_HELPER;
+    case 0xE:
+        if (in->NN == 0x9E || in->NN == 0xA1) return KIND_END_HELPER;
+        return KIND_UNKNOWN;
+    case 0xF:
+        switch(in->NN)
+        {
+        case 0x07:
+        case 0x15:
+        case 0x18:
+        case 0x29:
+        case 0x1E:
+            return KIND_NATIVE;
+        case 0x65:
+            return KIND_HELPER;
+        case 0x55:
+        case 0x33:
+        case 0x0A:
+            return KIND_END_HELPER;
+        default:
+            return KIND_UNKNOWN;
+        }
+    default:
+        return KIND_UNKNOWN;
+    }
+}
+
+// Counts how often each V register is touched by native code in the block
+static void count_uses(struct instruction *in, u32 *uses)
+{
+    switch(in->i)
+    {
+    case 0x3:
+    case 0x4:
+    case 0x6:
+    case 0x7:
+        uses[in->x]++;
+        break;
+    case 0x5:
+    case 0x9:
+        uses[in->x]++;
+        uses[in->y]++;
+        break;
+    case 0x8:
+        uses[in->x] += 2;
+        uses[in->y]++;
+        if (in->N >= 0x4) uses[0xF]++;
+        break;
+    case 0xF:
+        if (in->NN == 0x07 || in->NN == 0x15 || in->NN == 0x18 || in->NN == 0x29 || in->NN == 0x1E) uses[in->x]++;
+        break;
+    }
+}
+
+static void allocate_registers(struct translation *t, struct instruction *instructions, u16 count)
+{
+    u32 uses[16] = {0};
+    for (u16 n = 0; n < count; n++)
+    {
+        count_uses(&instructions[n], uses);
+    }
+
+    for (int x = 0; x < 16; x++)
+    {
+        t->host[x] = -1;
+    }
+
+    t->saved = 0;
+    for (int r = 0; r < JIT_HOST_REGISTERS; r++)
+    {
+        int best = -1;
+        for (int x = 0; x < 16; x++)
+        {
+            if (t->host[x] < 0 && uses[x] >= 2 && (best < 0 || uses[x] > uses[best])) best = x;
+        }
+        if (best < 0) break;
+        t->host[best] = host_registers[r];
+        t->saved++;
+    }
+}
+
+static void emit_native(struct translation *t, struct instruction *in)
+{
+    struct operand vx = v_operand(t, in->x);
+    struct operand vy = v_operand(t, in->y);
+    struct operand vf = v_operand(t, 0xF);
+    struct operand al = register_operand(RAX);
+    struct operand cl = register_operand(RCX);
+
+    switch(in->i)
+    {
+    case 0x6:
+        emit_rm8(t, 0xC6, 0, 0, vx); // mov vx, nn
+        emit8(t, in->NN);
+        break;
+    case 0x7:
+        emit_rm8(t, 0x80, 0, 0, vx); // add vx, nn
+        emit8(t, in->NN);
+        break;
+    case 0x8:
+        switch(in->N)
+        {
+        case 0x0:
+            emit_rm8(t, 0x8A, RAX, 1, vy); // mov al, vy
+            emit_rm8(t, 0x88, RAX, 1, vx); // mov vx, al
+            break;
+        case 0x1:
+        case 0x2:
+        case 0x3:
+            emit_rm8(t, 0x8A, RAX, 1, vy); // mov al, vy
+            emit_rm8(t, in->N == 0x1 ? 0x08 : in->N == 0x2 ? 0x20 : 0x30, RAX, 1, vx); // or/and/xor vx, al
+            break;
+        case 0x4:
+            emit_rm8(t, 0x8A, RAX, 1, vx); // mov al, vx
+            emit_rm8(t, 0x02, RAX, 1, vy); // add al, vy
+            emit_rm8(t, 0x0F92, 0, 0, cl); // setc cl
+            emit_rm8(t, 0x88, RCX, 1, vf); // mov vf, cl
+            emit_rm8(t, 0x88, RAX, 1, vx); // mov vx, al
+            break;
+        case 0x5:
+        case 0x7:
+        {
+            // vf is written before the subtraction so it reads the new vf, like the interpreter
+            struct operand a = in->N == 0x5 ? vx : vy;
+            struct operand b = in->N == 0x5 ? vy : vx;
+            emit_rm8(t, 0x8A, RAX, 1, a); // mov al, a
+            emit_rm8(t, 0x3A, RAX, 1, b); // cmp al, b
+            emit_rm8(t, 0x0F93, 0, 0, cl); // setae cl
+            emit_rm8(t, 0x88, RCX, 1, vf); // mov vf, cl
+            emit_rm8(t, 0x8A, RAX, 1, a); // mov al, a
+            emit_rm8(t, 0x2A, RAX, 1, b); // sub al, b
+            emit_rm8(t, 0x88, RAX, 1, vx); // mov vx, al
+            break;
+        }
+        case 0x6:
+            emit_rm8(t, 0xD0, 5, 0, vx); // shr vx, 1
+            emit_rm8(t, 0x8A, RAX, 1, vx); // mov al, vx
+            emit8(t, 0x24); emit8(t, 0x01); // and al, 1
+            emit_rm8(t, 0x88, RAX, 1, vf); // mov vf, al
+            break;
+        case 0xE:
+            emit_rm8(t, 0xD0, 4, 0, vx); // shl vx, 1
+            emit_rm8(t, 0x8A, RAX, 1, vx); // mov al, vx
+            emit_rm8(t, 0xC0, 5, 0, al); // shr al, 7
+            emit8(t, 7);
+            emit_rm8(t, 0x88, RAX, 1, vf); // mov vf, al
+            break;
+        }
+        break;
+    case 0xA:
+        emit_mem16(t, 0xC7, 0, OFF_I); // mov i, nnn
+        emit16(t, in->NNN);
+        break;
+    case 0xF:
+        switch(in->NN)
+        {
+        case 0x07:
+            emit_rm8(t, 0x8A, RAX, 1, memory_operand(OFF_DELAY)); // mov al, delay
+            emit_rm8(t, 0x88, RAX, 1, vx); // mov vx, al
+            break;
+        case 0x15:
+        case 0x18:
+            emit_rm8(t, 0x8A, RAX, 1, vx); // mov al, vx
+            emit_rm8(t, 0x88, RAX, 1, memory_operand(in->NN == 0x15 ? OFF_DELAY : OFF_SOUND)); // mov delay/sound, al
+            break;
+        case 0x29:
+            emit_rm8(t, 0x0FB6, RAX, 1, vx); // movzx eax, vx
+            emit8(t, 0x83); emit8(t, 0xE0); emit8(t, 0x0F); // and eax, 0xF
+            emit8(t, 0x8D); emit8(t, 0x44); emit8(t, 0x80); emit8(t, 0x50); // lea eax, [rax + rax * 4 + 0x50]
+            emit_mem16(t, 0x89, RAX, OFF_I); // mov i, ax
+            break;
+        case 0x1E:
+        {
+            emit_rm8(t, 0x0FB6, RAX, 1, vx); // movzx eax, vx
+            emit_mem16(t, 0x03, RAX, OFF_I); // add ax, i
+            emit_mem16(t, 0x89, RAX, OFF_I); // mov i, ax
+            emit8(t, 0x66); emit8(t, 0x3D); emit16(t, 0x1000); // cmp ax, 0x1000
+            emit8(t, 0x72); // jb over
+            u8 *jump = t->p;
+            emit8(t, 0);
+            emit_rm8(t, 0xC6, 0, 0, vf); // mov vf, 1
+            emit8(t, 1);
+            *jump = (u8)(t->p - jump - 1);
+            break;
+        }
+        }
+        break;
+    }
+}
+
+static void emit_helper(struct translation *t, struct instruction *in, u16 next_pc)
+{
+    switch(in->i)
+    {
+    case 0x0:
+        if (in->NNN == 0x000)
+            emit_call(t, (void *)in_halt, next_pc, 0, 0, 0, 0);
+        else if (in->NNN == 0x0E0)
+            emit_call(t, (void *)in_clear_screen, next_pc, 0, 0, 0, 0);
+        else if (in->NNN == 0x0EE)
+            emit_call(t, (void *)in_end_subroutine, next_pc, 0, 0, 0, 0);
+        else
+            emit_call(t, (void *)jit_execute, next_pc, 1, in->instruction, 0, 0);
+        break;
+    case 0x2:
+        emit_call(t, (void *)in_start_subroutine, next_pc, 1, in->NNN, 0, 0);
+        break;
+    case 0xB:
+        emit_call(t, (void *)in_jump_offset_classic, next_pc, 2, in->x, in->NNN, 0);
+        break;
+    case 0xC:
+        emit_call(t, (void *)in_random, next_pc, 2, in->x, in->NN, 0);
+        break;
+    case 0xD:
+        emit_call(t, (void *)in_display, next_pc, 3, in->x, in->y, in->N);
+        break;
+    default:
+        emit_call(t, (void *)jit_execute, next_pc, 1, in->instruction, 0, 0);
+        break;
+    }
+}
+
+// Writes back registers and pc for a block ending in a jump or skip, or running out of instructions
+static void emit_exit(struct translation *t, struct instruction *last, enum jit_kind kind, u16 address)
+{
+    emit_write_back(t);
+
+    if (kind != KIND_END_NATIVE)
+    {
+        if (kind != KIND_END_HELPER) emit_store_pc(t, address + 2);
+        return;
+    }
+
+    if (last->i == 0x1)
+    {
+        emit_store_pc(t, last->NNN);
+        return;
+    }
+
+    // Skips
+    emit_store_pc(t, address + 2);
+    switch(last->i)
+    {
+    case 0x3:
+    case 0x4:
+        emit_rm8(t, 0x80, 7, 0, v_operand(t, last->x)); // cmp vx, nn
+        emit8(t, last->NN);
+        break;
+    case 0x5:
+    case 0x9:
+        emit_rm8(t, 0x8A, RAX, 1, v_operand(t, last->y)); // mov al, vy
+        emit_rm8(t, 0x38, RAX, 1, v_operand(t, last->x)); // cmp vx, al
+        break;
+    }
+    emit8(t, (last->i == 0x3 || last->i == 0x5) ? 0x75 : 0x74); // jne/je over
+    u8 *jump = t->p;
+    emit8(t, 0);
+    emit_store_pc(t, address + 4);
+    *jump = (u8)(t->p - jump - 1);
+}
+
+void jit_flush()
+{
+    memset(jit.lookup, 0, sizeof(jit.lookup));
+    jit.block_count = 0;
+    jit.code_used = 0;
+}
+
+static struct jit_block *translate(struct chip8 *state, u16 start)
+{
+    if (jit.block_count >= JIT_MAX_BLOCKS || jit.code_used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE)
+    {
+        jit_flush();
+    }
+
+    struct instruction instructions[JIT_MAX_BLOCK_INSTRUCTIONS];
+    enum jit_kind kinds[JIT_MAX_BLOCK_INSTRUCTIONS];
+    u16 count = 0;
+    u16 address = start;
+    while (count < JIT_MAX_BLOCK_INSTRUCTIONS && address < MEMORY_SIZE - 1)
+    {
+        u16 instruction_bytes = ((u16)state->memory[address] << 8) + (u16)state->memory[address + 1];
+        decode_instruction(instruction_bytes, &instructions[count]);
+        kinds[count] = classify(&instructions[count]);
+        if (kinds[count] == KIND_UNKNOWN) break;
+
+        // Marking the address as decoded makes writes to it raise code_modified
+        state->decoded[address] = instructions[count];
+        state->decoded_valid[address] = 1;
+
+        count++;
+        address += 2;
+        if (kinds[count - 1] == KIND_END_NATIVE || kinds[count - 1] == KIND_END_HELPER) break;
+    }
+
+    struct jit_block *block = &jit.blocks[jit.block_count++];
+    block->length = count;
+    block->code = NULL;
+    jit.lookup[start] = block;
+    if (count == 0) return block;
+
+    struct translation t;
+    t.p = jit.code + jit.code_used;
+    u8 *code = t.p;
+    allocate_registers(&t, instructions, count);
+
+    emit_prologue(&t);
+    address = start;
+    for (u16 n = 0; n < count; n++)
+    {
+        if (kinds[n] == KIND_NATIVE)
+            emit_native(&t, &instructions[n]);
+        else if (kinds[n] == KIND_HELPER || kinds[n] == KIND_END_HELPER)
+            emit_helper(&t, &instructions[n], address + 2);
+
+        if (n == count - 1)
+            emit_exit(&t, &instructions[n], kinds[n], address);
+        address += 2;
+    }
+    emit_epilogue(&t);
+
+    jit.code_used += (u32)(t.p - code);
+    jit.code_used = (jit.code_used + 15) & ~15u;
+    block->code = (block_code)(void *)code;
+    return block;
+}
+
+u64 jit_run(struct chip8 *state, u64 count)
+{
+    if (jit.code == NULL && !jit.unavailable)
+    {
+        void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED)
+        {
+            printf("Failed to map executable memory for the JIT, using the threaded interpreter\n");
+            jit.unavailable = 1;
+        }
+        else
+        {
+            jit.code = (u8 *)code;
+        }
+    }
+    if (jit.unavailable) return run_threaded(state, count);
+
+    if (jit.owner != state || state->code_modified)
+    {
+        jit_flush();
+        jit.owner = state;
+        state->code_modified = 0;
+    }
+
+    u64 n = 0;
+    u64 native = 0;
+    while (n < count && !state->halt && !state->await_input)
+    {
+        u16 pc = state->cpu.pc;
+        struct jit_block *block = NULL;
+        if (pc < MEMORY_SIZE - 1)
+        {
+            block = jit.lookup[pc];
+            if (block == NULL) block = translate(state, pc);
+        }
+
+        if (block == NULL || block->length == 0 || block->length > count - n)
+        {
+            n += run_threaded(state, 1);
+        }
+        else
+        {
+            block->code(state);
+            n += block->length;
+            native += block->length;
+        }
+
+        if (state->code_modified)
+        {
+            jit_flush();
+            state->code_modified = 0;
+        }
+    }
+    state->cycles += native;
+    return n;
+}
+
+void jit_shutdown()
+{
+    if (jit.code != NULL)
+    {
+        munmap(jit.code, JIT_CODE_SIZE);
+        jit.code = NULL;
+    }
+    jit_flush();
+    jit.owner = NULL;
+}
+
+#else
+
+u64 jit_run(struct chip8 *state, u64 count)
+{
+    return run_threaded(state, count);
+}
+
+void jit_flush()
+{
+}
+
+void jit_shutdown()
+{
+}
+
+#endif
\ No newline at end of file
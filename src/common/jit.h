@@ -0,0 +1,32 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "types.h"
+
+/*
+x86-64 basic block JIT (Linux only)
+
+Straight line runs of instructions are translated into native code in an mmap'd
+executable buffer, a block ends at a jump, skip, call, return, Fx0A, Dxyn, or after
+an instruction that writes to memory (Fx55, Fx33)
+
+Inside a block pc is a constant known at translation time and only written back when
+a block exits or calls a helper, and the most used V registers are held in host registers
+
+Complex instructions call the in_* helpers (in_display, in_random, in_clear_screen) or
+go through execute_instruction, so every block has exactly the interpreter's semantics
+
+Translated addresses are marked in the predecoded cache, so a write into translated code
+raises code_modified and every block is thrown away before anything else runs
+
+The JIT keeps one set of blocks for one struct chip8 at a time, using it with
+a different struct chip8 flushes the blocks. On other hosts jit_run uses run_threaded
+*/
+
+struct chip8;
+
+u64 jit_run(struct chip8 *state, u64 count); // Runs until count, halt or awaiting input, returns instructions run
+void jit_flush();
+void jit_shutdown();
+
+#endif //_JIT_H_
\ No newline at end of file
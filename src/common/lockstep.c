@@ -0,0 +1,447 @@
+#include "lockstep.h"
+
+#include "chip8.h"
+#include "instructions.h"
+
+#include <string.h>
+
+#define NO_PC 0x10000 // Above every pc, for lanes with nothing left to run
+
+// Byte vectors, one lane per byte. Masks are 0xFF in lanes that take part and 0x00 elsewhere
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define VECTOR_BYTES 32
+typedef __m256i vec;
+
+static inline vec v_load(const u8 *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void v_store(u8 *p, vec a) { _mm256_storeu_si256((__m256i *)p, a); }
+static inline vec v_set(u8 b) { return _mm256_set1_epi8((char)b); }
+static inline vec v_add(vec a, vec b) { return _mm256_add_epi8(a, b); }
+static inline vec v_sub(vec a, vec b) { return _mm256_sub_epi8(a, b); }
+static inline vec v_and(vec a, vec b) { return _mm256_and_si256(a, b); }
+static inline vec v_or(vec a, vec b) { return _mm256_or_si256(a, b); }
+static inline vec v_xor(vec a, vec b) { return _mm256_xor_si256(a, b); }
+static inline vec v_andnot(vec a, vec b) { return _mm256_andnot_si256(a, b); } // ~a & b
+static inline vec v_eq(vec a, vec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline vec v_ge(vec a, vec b) { return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a); } // Unsigned a >= b
+static inline vec v_blend(vec a, vec b, vec mask) { return _mm256_blendv_epi8(a, b, mask); } // b where mask is set
+static inline vec v_shr1(vec a) { return _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F)); }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+#define VECTOR_BYTES 16
+typedef __m128i vec;
+
+static inline vec v_load(const u8 *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void v_store(u8 *p, vec a) { _mm_storeu_si128((__m128i *)p, a); }
+static inline vec v_set(u8 b) { return _mm_set1_epi8((char)b); }
+static inline vec v_add(vec a, vec b) { return _mm_add_epi8(a, b); }
+static inline vec v_sub(vec a, vec b) { return _mm_sub_epi8(a, b); }
+static inline vec v_and(vec a, vec b) { return _mm_and_si128(a, b); }
+static inline vec v_or(vec a, vec b) { return _mm_or_si128(a, b); }
+static inline vec v_xor(vec a, vec b) { return _mm_xor_si128(a, b); }
+static inline vec v_andnot(vec a, vec b) { return _mm_andnot_si128(a, b); } // ~a & b
+static inline vec v_eq(vec a, vec b) { return _mm_cmpeq_epi8(a, b); }
+static inline vec v_ge(vec a, vec b) { return _mm_cmpeq_epi8(_mm_max_epu8(a, b), a); } // Unsigned a >= b
+static inline vec v_blend(vec a, vec b, vec mask) { return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a)); } // b where mask is set
+static inline vec v_shr1(vec a) { return _mm_and_si128(_mm_srli_epi16(a, 1), _mm_set1_epi8(0x7F)); }
+
+#else
+
+#define VECTOR_BYTES 8
+typedef struct { u8 b[VECTOR_BYTES]; } vec;
+
+#define V_EACH(expression) vec r; for (int k = 0; k < VECTOR_BYTES; k++) r.b[k] = (u8)(expression); return r;
+static inline vec v_load(const u8 *p) { vec r; memcpy(r.b, p, VECTOR_BYTES); return r; }
+static inline void v_store(u8 *p, vec a) { memcpy(p, a.b, VECTOR_BYTES); }
+static inline vec v_set(u8 b) { V_EACH(b) }
+static inline vec v_add(vec a, vec b) { V_EACH(a.b[k] + b.b[k]) }
+static inline vec v_sub(vec a, vec b) { V_EACH(a.b[k] - b.b[k]) }
+static inline vec v_and(vec a, vec b) { V_EACH(a.b[k] & b.b[k]) }
+static inline vec v_or(vec a, vec b) { V_EACH(a.b[k] | b.b[k]) }
+static inline vec v_xor(vec a, vec b) { V_EACH(a.b[k] ^ b.b[k]) }
+static inline vec v_andnot(vec a, vec b) { V_EACH(~a.b[k] & b.b[k]) } // ~a & b
+static inline vec v_eq(vec a, vec b) { V_EACH(a.b[k] == b.b[k] ? 0xFF : 0) }
+static inline vec v_ge(vec a, vec b) { V_EACH(a.b[k] >= b.b[k] ? 0xFF : 0) } // Unsigned a >= b
+static inline vec v_blend(vec a, vec b, vec mask) { V_EACH(mask.b[k] ? b.b[k] : a.b[k]) } // b where mask is set
+static inline vec v_shr1(vec a) { V_EACH(a.b[k] >> 1) }
+
+#endif
+
+#define FOR_VECTORS(l) for (u32 l = 0; l < LOCKSTEP_LANES; l += VECTOR_BYTES)
+
+void init_lockstep(struct lockstep *group)
+{
+    memset(group, 0, sizeof(*group));
+}
+
+u8 add_lockstep_lane(struct lockstep *group, struct chip8 *state)
+{
+    if (group->lanes >= LOCKSTEP_LANES) return 0;
+
+    // Anywhere this lane's memory differs from the first one's is read lane by lane from the start
+    if (group->lanes > 0)
+    {
+        const u8 *first = group->machines[0]->memory;
+        for (u32 address = 0; address < MEMORY_SIZE; address++)
+        {
+            if (state->memory[address] != first[address]) group->written[address] = 1;
+        }
+    }
+    group->machines[group->lanes++] = state;
+    return 1;
+}
+
+static void load_lane(struct lockstep *group, u32 lane)
+{
+    struct cpu *cpu = &group->machines[lane]->cpu;
+    for (int reg = 0; reg < 16; reg++) group->v[reg][lane] = cpu->v[reg];
+    group->i[lane] = cpu->i;
+    group->pc[lane] = cpu->pc;
+    group->delay[lane] = cpu->delay;
+    group->sound[lane] = cpu->sound;
+}
+
+static void store_lane(struct lockstep *group, u32 lane)
+{
+    struct cpu *cpu = &group->machines[lane]->cpu;
+    for (int reg = 0; reg < 16; reg++) cpu->v[reg] = group->v[reg][lane];
+    cpu->i = group->i[lane];
+    cpu->pc = group->pc[lane];
+    cpu->delay = group->delay[lane];
+    cpu->sound = group->sound[lane];
+}
+
+// Runs the instruction on one lane's machine, for everything that touches memory, the stack or the screen
+static void run_lane(struct lockstep *group, u32 lane, struct instruction *instruction)
+{
+    struct chip8 *state = group->machines[lane];
+    group->scalar_instructions++;
+
+    // Draws, calls and returns are most of what runs lane by lane, they only need a couple of registers copied
+    if (instruction->i == 0xD)
+    {
+        state->cpu.v[instruction->x] = group->v[instruction->x][lane];
+        state->cpu.v[instruction->y] = group->v[instruction->y][lane];
+        state->cpu.i = group->i[lane];
+        in_display(state, instruction->x, instruction->y, instruction->N);
+        group->v[0xF][lane] = state->cpu.v[0xF];
+        return;
+    }
+    if (instruction->i == 0x2 || instruction->instruction == 0x00EE)
+    {
+        state->cpu.pc = group->pc[lane];
+        if (instruction->i == 0x2)
+            in_start_subroutine(state, instruction->NNN);
+        else
+            in_end_subroutine(state);
+        group->pc[lane] = state->cpu.pc;
+        return;
+    }
+
+    store_lane(group, lane);
+
+    if (instruction->i == 0xF && (instruction->NN == 0x33 || instruction->NN == 0x55))
+    {
+        u32 count = instruction->NN == 0x33 ? 3 : instruction->x + 1u;
+        for (u32 n = 0; n < count; n++) group->written[(state->cpu.i + n) & (MEMORY_SIZE - 1)] = 1;
+    }
+    if (!execute_instruction(state, instruction))
+    {
+        state->halt = 1;
+    }
+
+    load_lane(group, lane);
+}
+
+static void skip_lanes(struct lockstep *group, const u8 *skip)
+{
+    for (u32 l = 0; l < LOCKSTEP_LANES; l++) group->pc[l] += skip[l] & 2;
+}
+
+// Runs the instruction on every lane in mask, returns 0 if it has to be run lane by lane instead
+static u8 run_vector(struct lockstep *group, struct instruction *instruction, const u8 *mask)
+{
+    u8 *vx = group->v[instruction->x];
+    u8 *vy = group->v[instruction->y];
+    u8 *vf = group->v[0xF];
+    u8 skip[LOCKSTEP_LANES];
+
+    switch (instruction->i)
+    {
+    case 0x1:
+        for (u32 l = 0; l < LOCKSTEP_LANES; l++) if (mask[l]) group->pc[l] = instruction->NNN;
+        return 1;
+    case 0x3:
+        FOR_VECTORS(l) v_store(skip + l, v_and(v_load(mask + l), v_eq(v_load(vx + l), v_set(instruction->NN))));
+        skip_lanes(group, skip);
+        return 1;
+    case 0x4:
+        FOR_VECTORS(l) v_store(skip + l, v_andnot(v_eq(v_load(vx + l), v_set(instruction->NN)), v_load(mask + l)));
+        skip_lanes(group, skip);
+        return 1;
+    case 0x5:
+        if (instruction->N != 0) return 0;
+        FOR_VECTORS(l) v_store(skip + l, v_and(v_load(mask + l), v_eq(v_load(vx + l), v_load(vy + l))));
+        skip_lanes(group, skip);
+        return 1;
+    case 0x6:
+        FOR_VECTORS(l) v_store(vx + l, v_blend(v_load(vx + l), v_set(instruction->NN), v_load(mask + l)));
+        return 1;
+    case 0x7:
+        FOR_VECTORS(l)
+        {
+            vec a = v_load(vx + l);
+            v_store(vx + l, v_blend(a, v_add(a, v_set(instruction->NN)), v_load(mask + l)));
+        }
+        return 1;
+    case 0x8:
+        // VF is written before vx and read back after, in the same order as the in_ functions, so x or y being F works out the same
+        FOR_VECTORS(l)
+        {
+            vec m = v_load(mask + l);
+            vec a = v_load(vx + l);
+            vec b = v_load(vy + l);
+            switch (instruction->N)
+            {
+            case 0x0:
+                v_store(vx + l, v_blend(a, b, m));
+                break;
+            case 0x1:
+                v_store(vx + l, v_blend(a, v_or(a, b), m));
+                break;
+            case 0x2:
+                v_store(vx + l, v_blend(a, v_and(a, b), m));
+                break;
+            case 0x3:
+                v_store(vx + l, v_blend(a, v_xor(a, b), m));
+                break;
+            case 0x4:
+            {
+                vec sum = v_add(a, b);
+                vec carry = v_andnot(v_ge(sum, a), v_set(1)); // The sum wrapped below vx
+                v_store(vf + l, v_blend(v_load(vf + l), carry, m));
+                v_store(vx + l, v_blend(v_load(vx + l), sum, m));
+                break;
+            }
+            case 0x5:
+                v_store(vf + l, v_blend(v_load(vf + l), v_and(v_ge(a, b), v_set(1)), m));
+                a = v_load(vx + l);
+                b = v_load(vy + l);
+                v_store(vx + l, v_blend(a, v_sub(a, b), m));
+                break;
+            case 0x6:
+                v_store(vx + l, v_blend(a, v_shr1(a), m));
+                v_store(vf + l, v_blend(v_load(vf + l), v_and(v_load(vx + l), v_set(1)), m));
+                break;
+            case 0x7:
+                v_store(vf + l, v_blend(v_load(vf + l), v_and(v_ge(b, a), v_set(1)), m));
+                a = v_load(vx + l);
+                b = v_load(vy + l);
+                v_store(vx + l, v_blend(a, v_sub(b, a), m));
+                break;
+            case 0xE:
+                v_store(vx + l, v_blend(a, v_add(a, a), m));
+                v_store(vf + l, v_blend(v_load(vf + l), v_and(v_ge(v_load(vx + l), v_set(0x80)), v_set(1)), m));
+                break;
+            default:
+                return 0;
+            }
+        }
+        return 1;
+    case 0x9:
+        if (instruction->N != 0) return 0;
+        FOR_VECTORS(l) v_store(skip + l, v_andnot(v_eq(v_load(vx + l), v_load(vy + l)), v_load(mask + l)));
+        skip_lanes(group, skip);
+        return 1;
+    case 0xA:
+        for (u32 l = 0; l < LOCKSTEP_LANES; l++) if (mask[l]) group->i[l] = instruction->NNN;
+        return 1;
+    case 0xB:
+        for (u32 l = 0; l < LOCKSTEP_LANES; l++) if (mask[l]) group->pc[l] = instruction->NNN + group->v[0][l];
+        return 1;
+    case 0xC:
+        for (u32 l = 0; l < LOCKSTEP_LANES; l++) if (mask[l]) vx[l] = (u8)(next_random(group->machines[l]) >> 24) & instruction->NN;
+        return 1;
+    case 0xE:
+        if (instruction->NN != 0x9E && instruction->NN != 0xA1) return 0;
+        for (u32 l = 0; l < LOCKSTEP_LANES; l++)
+        {
+            u8 pressed = mask[l] && (group->machines[l]->keys & KEY_BIT(vx[l]));
+            skip[l] = mask[l] && pressed == (instruction->NN == 0x9E) ? 0xFF : 0;
+        }
+        skip_lanes(group, skip);
+        return 1;
+    case 0xF:
+        switch (instruction->NN)
+        {
+        case 0x07:
+            FOR_VECTORS(l) v_store(vx + l, v_blend(v_load(vx + l), v_load(group->delay + l), v_load(mask + l)));
+            return 1;
+        case 0x15:
+            FOR_VECTORS(l) v_store(group->delay + l, v_blend(v_load(group->delay + l), v_load(vx + l), v_load(mask + l)));
+            return 1;
+        case 0x18:
+            FOR_VECTORS(l) v_store(group->sound + l, v_blend(v_load(group->sound + l), v_load(vx + l), v_load(mask + l)));
+            return 1;
+        case 0x1E:
+            for (u32 l = 0; l < LOCKSTEP_LANES; l++)
+            {
+                if (!mask[l]) continue;
+                group->i[l] += vx[l];
+                if (group->i[l] >= 0x1000) vf[l] = 1;
+            }
+            return 1;
+        case 0x29:
+            for (u32 l = 0; l < LOCKSTEP_LANES; l++) if (mask[l]) group->i[l] = 0x50 + 5 * (vx[l] & 0xF);
+            return 1;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+// Masks in every lane with instructions left at the lowest pc any of them is at, returns the first of them or LOCKSTEP_LANES if there are none
+static u32 next_lanes(struct lockstep *group, u8 *mask)
+{
+    u32 lowest = NO_PC;
+    for (u32 l = 0; l < LOCKSTEP_LANES; l++)
+    {
+        u32 pc = group->remaining[l] ? group->pc[l] : NO_PC;
+        if (pc < lowest) lowest = pc;
+    }
+    if (lowest == NO_PC) return LOCKSTEP_LANES;
+
+    u32 first = LOCKSTEP_LANES;
+    for (u32 l = 0; l < LOCKSTEP_LANES; l++)
+    {
+        mask[l] = group->remaining[l] && group->pc[l] == lowest ? 0xFF : 0;
+        if (mask[l] && first == LOCKSTEP_LANES) first = l;
+    }
+    return first;
+}
+
+static u16 read_opcode(struct chip8 *state, u16 pc)
+{
+    return ((u16)state->memory[pc & (MEMORY_SIZE - 1)] << 8) + (u16)state->memory[(pc + 1) & (MEMORY_SIZE - 1)];
+}
+
+// Whether every lane in mask is still at the first one's pc and can carry on
+static u8 together(struct lockstep *group, const u8 *mask, u32 first)
+{
+    for (u32 l = first; l < LOCKSTEP_LANES; l++)
+    {
+        if (!mask[l]) continue;
+        struct chip8 *state = group->machines[l];
+        if (group->pc[l] != group->pc[first] || state->halt || state->await_input) return 0;
+    }
+    return 1;
+}
+
+// Runs up to count instructions on the lanes in mask, which all start at the same pc, until
+// they go different ways or reach the lowest pc another lane is waiting at, where they might
+// join up with it. Returns how many each of them ran
+static u32 run_together(struct lockstep *group, u8 *mask, u32 first, u32 count)
+{
+    u32 waiting = NO_PC;
+    for (u32 l = 0; l < LOCKSTEP_LANES; l++)
+    {
+        if (group->remaining[l] && !mask[l] && group->pc[l] < waiting) waiting = group->pc[l];
+    }
+
+    u32 ran = 0;
+    while (ran < count && group->pc[first] < waiting)
+    {
+        u16 pc = group->pc[first];
+        u16 opcode = read_opcode(group->machines[first], pc);
+        if (group->written[pc & (MEMORY_SIZE - 1)] || group->written[(pc + 1) & (MEMORY_SIZE - 1)])
+        {
+            // Lanes with something else here wait for a step of their own
+            for (u32 l = first + 1; l < LOCKSTEP_LANES; l++)
+            {
+                if (!mask[l] || read_opcode(group->machines[l], pc) == opcode) continue;
+                if (ran > 0) return ran;
+                mask[l] = 0;
+            }
+        }
+
+        struct instruction instruction;
+        decode_instruction(opcode, &instruction);
+        for (u32 l = 0; l < LOCKSTEP_LANES; l++) group->pc[l] += mask[l] & 2;
+        ran++;
+
+        u8 vector = run_vector(group, &instruction, mask);
+        if (!vector)
+        {
+            for (u32 l = first; l < LOCKSTEP_LANES; l++)
+            {
+                if (mask[l]) run_lane(group, l, &instruction);
+            }
+        }
+
+        // Only branches and the instructions run lane by lane can split the lanes up
+        u8 branch = instruction.i == 0x3 || instruction.i == 0x4 || instruction.i == 0x5 || instruction.i == 0x9 ||
+            instruction.i == 0xB || instruction.i == 0xE;
+        if ((branch || !vector) && !together(group, mask, first)) return ran;
+    }
+    return ran;
+}
+
+void lockstep_frame(struct lockstep *group, u32 budget)
+{
+    u32 executed[LOCKSTEP_LANES] = {0};
+    u8 halted[LOCKSTEP_LANES] = {0};
+    for (u32 l = 0; l < LOCKSTEP_LANES; l++)
+    {
+        group->remaining[l] = 0;
+        if (l >= group->lanes) continue;
+
+        struct chip8 *state = group->machines[l];
+        load_lane(group, l);
+        halted[l] = state->halt;
+        if (!state->halt && !state->await_input) group->remaining[l] = budget;
+    }
+
+    u8 mask[LOCKSTEP_LANES];
+    u32 first;
+    while ((first = next_lanes(group, mask)) != LOCKSTEP_LANES)
+    {
+        // Nothing needs checking between instructions until the lane with the least budget left runs out
+        u32 count = budget;
+        u32 lanes = 0;
+        for (u32 l = first; l < LOCKSTEP_LANES; l++)
+        {
+            if (!mask[l]) continue;
+            if (group->remaining[l] < count) count = group->remaining[l];
+        }
+
+        u32 ran = run_together(group, mask, first, count);
+        for (u32 l = first; l < LOCKSTEP_LANES; l++)
+        {
+            if (!mask[l]) continue;
+            struct chip8 *state = group->machines[l];
+            group->remaining[l] = state->halt || state->await_input ? 0 : group->remaining[l] - ran;
+            executed[l] += ran;
+            lanes++;
+        }
+        group->steps += ran;
+        group->lane_instructions += (u64)ran * lanes;
+    }
+
+    for (u32 l = 0; l < group->lanes; l++)
+    {
+        // Like tick_timers after run_engine, which still ticks in the frame a machine halts in
+        struct chip8 *state = group->machines[l];
+        if (!halted[l])
+        {
+            if (group->delay[l] > 0) group->delay[l]--;
+            if (group->sound[l] > 0) group->sound[l]--;
+        }
+        store_lane(group, l);
+        state->cycles += executed[l];
+    }
+}
\ No newline at end of file
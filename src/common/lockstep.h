@@ -0,0 +1,61 @@
+#ifndef _LOCKSTEP_H_
+#define _LOCKSTEP_H_
+
+#include "types.h"
+#include "chip8.h"
+
+/*
+Lockstep interpreter
+
+Machines running the same rom spend most of their time at the same pc. A lockstep group
+holds up to LOCKSTEP_LANES of them with the registers laid out as a structure of arrays,
+register n of every lane side by side and the same for I, pc and the timers, so one
+decoded instruction runs on every lane at once. Loads, stores, blends and compares go
+through AVX2 when the compiler targets it (C8_AVX2 in CMake), SSE2 on any other x86-64
+and plain loops everywhere else
+
+Each step runs the instruction at the lowest pc any lane with instructions left is at, on
+every lane sitting at that pc. Lanes that branched elsewhere are masked out until the
+others catch up with them, which brings lanes back together after an if/else. Arithmetic,
+skips, jumps, I, timers, keys and random run on the arrays. Calls and returns, draws,
+BCD, loads, stores and Fx0A go lane by lane through execute_instruction on the lane's own
+struct chip8, which keeps its memory, stack, screen and generator, with the registers
+copied across and back
+
+The registers are gathered into the arrays when a frame starts and put back into the
+machines when it ends, so between frames every machine can be used like any other. Every
+lane runs exactly its own budget and ends each frame where running it on its own would
+have left it
+
+Memory is only read from one lane as long as no lane has written to that address. A store
+marks the addresses it wrote, and an instruction fetched from one is compared lane by lane
+so a lane whose code changed under it is run on its own
+*/
+
+#define LOCKSTEP_LANES 32
+
+struct lockstep
+{
+    // One entry per lane, only valid while a frame is running
+    u8 v[16][LOCKSTEP_LANES];
+    u16 i[LOCKSTEP_LANES];
+    u16 pc[LOCKSTEP_LANES];
+    u8 delay[LOCKSTEP_LANES];
+    u8 sound[LOCKSTEP_LANES];
+    u32 remaining[LOCKSTEP_LANES]; // Instructions left this frame, 0 once a lane halts or waits for a key
+
+    struct chip8 *machines[LOCKSTEP_LANES];
+    u32 lanes;
+    u8 written[MEMORY_SIZE]; // Addresses that may hold something different in different lanes
+
+    // Stats
+    u64 steps;
+    u64 lane_instructions;
+    u64 scalar_instructions; // Run through execute_instruction one lane at a time
+};
+
+void init_lockstep(struct lockstep *group);
+u8 add_lockstep_lane(struct lockstep *group, struct chip8 *state); // Returns 0 if the group is full
+void lockstep_frame(struct lockstep *group, u32 budget); // Runs budget instructions on every lane and ticks the timers of lanes that hadn't halted before it
+
+#endif //_LOCKSTEP_H_
\ No newline at end of file
@@ -0,0 +1,388 @@
+#include "movie.h"
+
+#include "chip8.h"
+#include "instructions.h"
+#include "platform.h"
+#include "snapshot.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NO_RECORD ((u64)-1)
+
+static const u8 movie_magic[8] = { 'C', '8', 'M', 'O', 'V', 'I', 'E', 0 };
+
+enum movie_mode
+{
+    MOVIE_OFF,
+    MOVIE_RECORDING,
+    MOVIE_PLAYING,
+};
+
+struct movie_state
+{
+    enum movie_mode mode;
+    char path[PF_MAX_PATH];
+
+    // Recording: the file as it's built up. Playback: the whole file
+    u8 *data;
+    u32 size;
+    u32 capacity;
+
+    u64 frame; // Frames started so far
+    u64 last_record; // Frame of the last record written or read
+    u16 held;
+    u16 pressed;
+
+    // Playback
+    u32 cursor;
+    u64 next_record; // Frame of the next record, NO_RECORD once the end has been read
+    u8 type; // Of the next record
+
+    // Stats
+    u64 key_records;
+    u64 steps;
+    u64 checkpoints;
+    u64 mismatches;
+    u64 first_mismatch;
+    u64 start_us;
+};
+
+static struct movie_state movie;
+
+u8 movie_recording()
+{
+    return movie.mode == MOVIE_RECORDING;
+}
+
+u8 movie_playing()
+{
+    return movie.mode == MOVIE_PLAYING;
+}
+
+static u8 reserve(u32 size)
+{
+    if (movie.size + size <= movie.capacity) return 1;
+
+    u32 capacity = movie.capacity ? movie.capacity : 4096;
+    while (capacity < movie.size + size) capacity *= 2;
+    u8 *grown = realloc(movie.data, capacity);
+    if (grown == NULL) return 0;
+    movie.data = grown;
+    movie.capacity = capacity;
+    return 1;
+}
+
+static void put_bytes(const u8 *bytes, u32 size)
+{
+    if (!reserve(size)) return;
+    memcpy(&movie.data[movie.size], bytes, size);
+    movie.size += size;
+}
+
+static void put_u8(u8 value)
+{
+    put_bytes(&value, 1);
+}
+
+static void put_u16(u16 value)
+{
+    u8 bytes[2] = { (u8)value, (u8)(value >> 8) };
+    put_bytes(bytes, 2);
+}
+
+static void put_u32(u32 value)
+{
+    put_u16((u16)value);
+    put_u16((u16)(value >> 16));
+}
+
+static void put_u64(u64 value)
+{
+    put_u32((u32)value);
+    put_u32((u32)(value >> 32));
+}
+
+static void put_record(enum movie_record type)
+{
+    // Frames since the last record, 7 bits a byte with the top bit set on all but the last
+    u64 gap = movie.frame - movie.last_record;
+    while (gap >= 0x80)
+    {
+        put_u8((u8)(gap | 0x80));
+        gap >>= 7;
+    }
+    put_u8((u8)gap);
+    put_u8((u8)type);
+    movie.last_record = movie.frame;
+}
+
+// Playback reads return 0 past the end of the file
+static u8 get_bytes(u8 *bytes, u32 size)
+{
+    if (movie.size - movie.cursor < size) return 0;
+    memcpy(bytes, &movie.data[movie.cursor], size);
+    movie.cursor += size;
+    return 1;
+}
+
+static u64 get_le(u32 size)
+{
+    u8 bytes[8] = {0};
+    get_bytes(bytes, size);
+    u64 value = 0;
+    for (int i = (int)size - 1; i >= 0; i--) value = (value << 8) | bytes[i];
+    return value;
+}
+
+// Reads the frame and type of the next record
+static void next_record()
+{
+    u64 gap = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        u8 byte;
+        if (!get_bytes(&byte, 1))
+        {
+            printf("Recording ends early at frame %" PRIu64 "\n", movie.last_record);
+            movie.next_record = NO_RECORD;
+            return;
+        }
+        gap |= (u64)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) break;
+    }
+    if (!get_bytes(&movie.type, 1))
+    {
+        movie.next_record = NO_RECORD;
+        return;
+    }
+    movie.last_record += gap;
+    movie.next_record = movie.last_record;
+}
+
+static void check_hash(struct chip8 *state, u64 hash)
+{
+    movie.checkpoints++;
+    if (hash_screen(state) == hash) return;
+
+    if (movie.mismatches == 0)
+    {
+        movie.first_mismatch = movie.frame;
+        printf("Replay framebuffer doesn't match the recording at frame %" PRIu64 "\n", movie.frame);
+    }
+    movie.mismatches++;
+}
+
+u8 movie_record(struct chip8 *state, const char *path, u32 seed, u32 tick_rate)
+{
+    if (strlen(path) >= sizeof(movie.path))
+    {
+        printf("Recording path is too long: %s\n", path);
+        return 0;
+    }
+
+    memset(&movie, 0, sizeof(movie));
+    strcpy(movie.path, path);
+
+    static u8 snapshot[SNAPSHOT_MAX_SIZE];
+    u32 snapshot_size = save_snapshot(state, snapshot, sizeof(snapshot), SNAPSHOT_COMPRESSED);
+
+    put_bytes(movie_magic, sizeof(movie_magic));
+    put_u16(MOVIE_VERSION);
+    put_u16(0);
+    put_u32(seed);
+    put_u32(tick_rate);
+    put_u32(snapshot_size);
+    put_bytes(snapshot, snapshot_size);
+    if (movie.size != MOVIE_HEADER_SIZE + snapshot_size)
+    {
+        printf("Failed to allocate the recording\n");
+        free(movie.data);
+        memset(&movie, 0, sizeof(movie));
+        return 0;
+    }
+
+    movie.mode = MOVIE_RECORDING;
+    movie.start_us = pf_get_time_us();
+    printf("Recording to %s with seed %" PRIu32 "\n", path, seed);
+    return 1;
+}
+
+void movie_record_step()
+{
+    if (movie.mode != MOVIE_RECORDING) return;
+    put_record(MOVIE_STEP);
+    movie.steps++;
+}
+
+u8 movie_play(struct chip8 *state, const char *path, u32 *tick_rate)
+{
+    memset(&movie, 0, sizeof(movie));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("Failed to open recording: %s\n", path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size < MOVIE_HEADER_SIZE || !reserve((u32)size))
+    {
+        printf("Recording is too short or too large to load: %s\n", path);
+        fclose(file);
+        return 0;
+    }
+    movie.size = (u32)fread(movie.data, 1, (size_t)size, file);
+    fclose(file);
+
+    u8 magic[8];
+    get_bytes(magic, sizeof(magic));
+    u16 version = (u16)get_le(2);
+    u16 quirks = (u16)get_le(2);
+    u32 seed = (u32)get_le(4);
+    *tick_rate = (u32)get_le(4);
+    u32 snapshot_size = (u32)get_le(4);
+
+    if (memcmp(magic, movie_magic, sizeof(magic)) != 0 || version != MOVIE_VERSION || quirks != 0)
+    {
+        printf("Not a recording this build can play: %s\n", path);
+        free(movie.data);
+        memset(&movie, 0, sizeof(movie));
+        return 0;
+    }
+    if (snapshot_size > movie.size - movie.cursor || !load_snapshot(state, &movie.data[movie.cursor], snapshot_size))
+    {
+        printf("Failed to load the state the recording starts from\n");
+        free(movie.data);
+        memset(&movie, 0, sizeof(movie));
+        return 0;
+    }
+    movie.cursor += snapshot_size;
+    strncpy(movie.path, path, sizeof(movie.path) - 1);
+
+    next_record();
+    movie.mode = MOVIE_PLAYING;
+    movie.start_us = pf_get_time_us();
+    printf("Replaying %s with seed %" PRIu32 " at %" PRIu32 " instructions a second\n", path, seed, *tick_rate);
+    return 1;
+}
+
+static void step(struct chip8 *state)
+{
+    if (state->halt || state->await_input) return;
+
+    struct instruction *instruction = fetch_decoded(state);
+    if (!execute_instruction(state, instruction))
+    {
+        state->halt = 1;
+    }
+    state->cycles++;
+}
+
+// Plays every record for the current frame, returns 0 when it reaches the end
+static u8 play_records(struct chip8 *state)
+{
+    while (movie.next_record == movie.frame)
+    {
+        switch (movie.type)
+        {
+        case MOVIE_KEYS:
+            movie.held = (u16)get_le(2);
+            movie.pressed = (u16)get_le(2);
+            movie.key_records++;
+            break;
+        case MOVIE_STEP:
+            step(state);
+            movie.steps++;
+            break;
+        case MOVIE_HASH:
+            check_hash(state, get_le(8));
+            break;
+        case MOVIE_END:
+            check_hash(state, get_le(8));
+            movie.next_record = NO_RECORD;
+            return 0;
+        default:
+            printf("Unknown record %d at frame %" PRIu64 "\n", (int)movie.type, movie.frame);
+            movie.next_record = NO_RECORD;
+            return 0;
+        }
+        next_record();
+    }
+    return movie.next_record != NO_RECORD;
+}
+
+u8 movie_frame(struct chip8 *state, u16 *held, u16 *pressed)
+{
+    if (movie.mode == MOVIE_RECORDING)
+    {
+        if (movie.frame % MOVIE_HASH_INTERVAL == 0)
+        {
+            put_record(MOVIE_HASH);
+            put_u64(hash_screen(state));
+        }
+        if (*held != movie.held || *pressed != movie.pressed)
+        {
+            put_record(MOVIE_KEYS);
+            put_u16(*held);
+            put_u16(*pressed);
+            movie.held = *held;
+            movie.pressed = *pressed;
+            movie.key_records++;
+        }
+        movie.frame++;
+        return 1;
+    }
+
+    if (movie.mode == MOVIE_PLAYING)
+    {
+        if (!play_records(state))
+        {
+            movie_stop(state);
+            return 0;
+        }
+        *held = movie.held;
+        *pressed = movie.pressed;
+        movie.frame++;
+    }
+    return 1;
+}
+
+void movie_stop(struct chip8 *state)
+{
+    if (movie.mode == MOVIE_OFF) return;
+
+    f64 seconds = (pf_get_time_us() - movie.start_us) / 1000000.0;
+    if (movie.mode == MOVIE_RECORDING)
+    {
+        put_record(MOVIE_END);
+        put_u64(hash_screen(state));
+        if (pf_write_file(movie.path, movie.data, movie.size))
+        {
+            printf("Recorded %" PRIu64 " frames (%.1f s emulated) to %s, %" PRIu64 " key changes and %" PRIu64 " steps in %" PRIu32 " bytes\n",
+                movie.frame, (f64)movie.frame / FRAME_RATE, movie.path, movie.key_records, movie.steps, movie.size);
+        }
+    }
+    else if (movie.mode == MOVIE_PLAYING)
+    {
+        // A run that halted or was cut short can still be sitting on the end of the recording
+        if (movie.next_record != NO_RECORD) play_records(state);
+
+        if (seconds <= 0.0) seconds = 1e-6;
+        printf("Replayed %" PRIu64 " frames (%.1f s emulated) in %.3f s, %.0fx real time\n",
+            movie.frame, (f64)movie.frame / FRAME_RATE, seconds, (f64)movie.frame / FRAME_RATE / seconds);
+        if (movie.mismatches == 0)
+            printf("Framebuffers matched at all %" PRIu64 " checkpoints\n", movie.checkpoints);
+        else
+            printf("Framebuffers differed at %" PRIu64 " of %" PRIu64 " checkpoints, first at frame %" PRIu64 "\n",
+                movie.mismatches, movie.checkpoints, movie.first_mismatch);
+        if (movie.next_record != NO_RECORD) printf("Stopped before the end of the recording\n");
+    }
+
+    free(movie.data);
+    memset(&movie, 0, sizeof(movie));
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+#ifndef _MOVIE_H_
+#define _MOVIE_H_
+
+#include "types.h"
+
+/*
+Input recordings
+
+A recording holds everything a run depends on besides the engine, which never changes the
+result: the tick rate, a snapshot of the machine it starts from (so it doesn't need the
+rom or font, and it carries the random number generator) and then a stream of records
+stamped with the frame they happen at, little endian like snapshots
+
+Header (MOVIE_HEADER_SIZE bytes)
+    magic          8 bytes "C8MOVIE\0"
+    version        u16
+    quirks         u16, 0, there are no quirk settings yet
+    seed           u32, what the generator was seeded with, 0 if it came from a save state
+    tick rate      u32
+    snapshot size  u32, a save_snapshot of the starting state follows the header
+
+Each record is the frames since the last record as an LEB128 varint, a type byte and
+the type's data
+
+    MOVIE_KEYS    held u16, pressed u16, whenever either changes from the last frame
+    MOVIE_STEP    one instruction was stepped on its own before the frame
+    MOVIE_HASH    hash_screen at the start of the frame, every MOVIE_HASH_INTERVAL frames
+    MOVIE_END     hash_screen u64 where the recording stopped
+
+Playback feeds the keys back in place of the host's and checks every hash against the
+screen it gets, so a replay either lands on identical framebuffers at the same frames
+or says at which frame it stopped matching
+*/
+
+#define MOVIE_VERSION 2 // Version 1 used the host's rand() and can't be replayed
+#define MOVIE_HEADER_SIZE 24
+#define MOVIE_HASH_INTERVAL 60
+
+struct chip8;
+
+enum movie_record
+{
+    MOVIE_KEYS,
+    MOVIE_STEP,
+    MOVIE_HASH,
+    MOVIE_END,
+};
+
+u8 movie_record(struct chip8 *state, const char *path, u32 seed, u32 tick_rate); // Starts recording from the current state, returns 0 on failure
+void movie_record_step(); // Call after an instruction is stepped outside a frame
+u8 movie_play(struct chip8 *state, const char *path, u32 *tick_rate); // Loads the starting state, returns 0 on failure
+u8 movie_frame(struct chip8 *state, u16 *held, u16 *pressed); // Call at the start of every frame, returns 0 once playback has run out
+void movie_stop(struct chip8 *state); // Writes out a recording or finishes playback, and prints a report
+u8 movie_recording();
+u8 movie_playing();
+
+#endif //_MOVIE_H_
\ No newline at end of file
@@ -0,0 +1,466 @@
+#include "netplay.h"
+
+#include "chip8.h"
+#include "platform.h"
+#include "snapshot.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PACKET_MAX 256
+#define START_SIZE 22
+#define INPUT_HEADER_SIZE 11
+#define INPUT_CHECK_SIZE 20
+#define SEND_MAX NETPLAY_RING // Frames in one input packet
+#define NO_ROLLBACK 0xFFFFFFFF
+#define HANDSHAKE_TIMEOUT_US 30000000
+#define HELLO_INTERVAL_US 100000
+#define RESEND_US (1000000 / FRAME_RATE) // Unacknowledged keys go again at least this often
+#define LINK_TIMEOUT_US 5000000 // Nothing from the other side for this long means it's gone
+
+struct net_frame
+{
+    u8 payload[SNAPSHOT_PAYLOAD_SIZE]; // State at the start of the frame
+    u64 screen_hash; // At the start of the frame, only on checkpoints
+    u32 budget;
+    u16 held; // Local keys
+    u16 pressed;
+    u16 remote_held; // Remote keys the frame ran with, guessed or real
+    u16 remote_pressed;
+};
+
+struct net_keys
+{
+    u16 held;
+    u16 pressed;
+};
+
+struct net_check
+{
+    u32 frame;
+    u8 local; // Whether each side's hashes are in
+    u8 remote;
+    u8 compared;
+    u64 local_screen;
+    u64 local_state;
+    u64 remote_screen;
+    u64 remote_state;
+};
+
+struct netplay_state
+{
+    u8 linked;
+    int player;
+    u8 start[START_SIZE]; // Player 1 sends it again if player 2 never heard it
+
+    u32 frame; // Frames started
+    u32 received; // Remote frames received, always in order
+    u32 acked; // Local frames the other side has received
+    u32 rollback_from; // Earliest frame that ran with the wrong remote keys, NO_ROLLBACK if none did
+    struct net_frame frames[NETPLAY_RING];
+    struct net_keys remote[NETPLAY_RING];
+
+    u32 next_check; // Next checkpoint to hash once every key before it is known
+    struct net_check checks[NETPLAY_CHECKS];
+    u32 sent_check; // Newest local checkpoint, NETPLAY_NO_CHECK before the first
+    u64 sent_screen;
+    u64 sent_state;
+
+    u8 packet[PACKET_MAX];
+    u32 packet_size;
+    u32 last_sent_frame;
+    u64 last_send_us;
+    u64 last_receive_us;
+
+    // Stats
+    u64 start_us;
+    u64 waits;
+    u64 sent;
+    u64 packets_received;
+    u64 rollbacks;
+    u64 resimulated;
+    u32 deepest;
+    u64 resim_ns;
+    u64 resim_max_ns;
+    u64 resim_late; // Took longer than a frame
+    u64 checks_matched;
+    u64 desyncs;
+    u32 first_desync;
+};
+
+static struct netplay_state net;
+
+u8 netplay_active()
+{
+    return net.linked;
+}
+
+static void put_le(u64 value, u32 size)
+{
+    for (u32 i = 0; i < size && net.packet_size < PACKET_MAX; i++)
+    {
+        net.packet[net.packet_size++] = (u8)(value >> (8 * i));
+    }
+}
+
+// Sizes are checked before anything is read
+static u64 get_le(const u8 **in, u32 size)
+{
+    u64 value = 0;
+    for (int i = (int)size - 1; i >= 0; i--) value = (value << 8) | (*in)[i];
+    *in += size;
+    return value;
+}
+
+static void begin_packet(enum netplay_packet type)
+{
+    net.packet_size = 0;
+    put_le(type, 1);
+    put_le(NETPLAY_VERSION, 1);
+}
+
+static void send_packet()
+{
+    if (pf_udp_send(net.packet, net.packet_size)) net.sent++;
+}
+
+static void send_input()
+{
+    u32 count = net.frame - net.acked;
+    if (count > SEND_MAX) count = SEND_MAX;
+
+    begin_packet(NET_INPUT);
+    put_le(net.received, 4);
+    put_le(net.acked, 4);
+    put_le(count, 1);
+    for (u32 frame = net.acked; frame < net.acked + count; frame++)
+    {
+        struct net_frame *saved = &net.frames[frame % NETPLAY_RING];
+        put_le(saved->held, 2);
+        put_le(saved->pressed, 2);
+    }
+    put_le(net.sent_check, 4);
+    put_le(net.sent_screen, 8);
+    put_le(net.sent_state, 8);
+    send_packet();
+
+    net.last_sent_frame = net.frame;
+    net.last_send_us = pf_get_time_us();
+}
+
+// The keys the other player pressed on a frame, or a guess that they're still holding what they last held
+static void remote_keys(u32 frame, u16 *held, u16 *pressed)
+{
+    if (frame < net.received)
+    {
+        *held = net.remote[frame % NETPLAY_RING].held;
+        *pressed = net.remote[frame % NETPLAY_RING].pressed;
+        return;
+    }
+    *held = net.received > 0 ? net.remote[(net.received - 1) % NETPLAY_RING].held : 0;
+    *pressed = 0;
+}
+
+static void save_frame(struct chip8 *state, u32 frame)
+{
+    struct net_frame *saved = &net.frames[frame % NETPLAY_RING];
+    write_snapshot_payload(state, saved->payload);
+    saved->screen_hash = frame % NETPLAY_HASH_INTERVAL == 0 ? hash_screen(state) : 0;
+}
+
+static void add_check(u32 frame, u64 screen, u64 state_hash, u8 local)
+{
+    struct net_check *check = &net.checks[(frame / NETPLAY_HASH_INTERVAL) % NETPLAY_CHECKS];
+    if (check->local || check->remote)
+    {
+        if (frame < check->frame) return; // A late packet about a checkpoint long gone
+        if (frame > check->frame) memset(check, 0, sizeof(*check));
+    }
+    check->frame = frame;
+
+    if (local)
+    {
+        check->local = 1;
+        check->local_screen = screen;
+        check->local_state = state_hash;
+    }
+    else
+    {
+        check->remote = 1;
+        check->remote_screen = screen;
+        check->remote_state = state_hash;
+    }
+    if (!check->local || !check->remote || check->compared) return;
+
+    check->compared = 1;
+    if (check->local_screen == check->remote_screen && check->local_state == check->remote_state)
+    {
+        net.checks_matched++;
+        return;
+    }
+    if (net.desyncs == 0)
+    {
+        net.first_desync = frame;
+        printf("Desync at frame %" PRIu32 ", the %s doesn't match player %d's\n",
+            frame, check->local_screen != check->remote_screen ? "screen" : "state", 3 - net.player);
+    }
+    net.desyncs++;
+}
+
+static void receive_input(const u8 *data, u32 size)
+{
+    if (size < INPUT_HEADER_SIZE) return;
+    const u8 *in = data + 2;
+    u32 ack = (u32)get_le(&in, 4);
+    u32 first = (u32)get_le(&in, 4);
+    u32 count = (u32)get_le(&in, 1);
+    if (size != INPUT_HEADER_SIZE + 4 * count + INPUT_CHECK_SIZE) return;
+
+    if (ack > net.acked && ack <= net.frame) net.acked = ack;
+    for (u32 frame = first; frame < first + count; frame++)
+    {
+        struct net_keys keys;
+        keys.held = (u16)get_le(&in, 2);
+        keys.pressed = (u16)get_le(&in, 2);
+        if (frame != net.received) continue; // Already have it, or there's a gap the resend will fill
+
+        net.remote[frame % NETPLAY_RING] = keys;
+        net.received++;
+        if (frame >= net.frame) continue;
+
+        struct net_frame *saved = &net.frames[frame % NETPLAY_RING];
+        if ((saved->remote_held != keys.held || saved->remote_pressed != keys.pressed) && frame < net.rollback_from)
+        {
+            net.rollback_from = frame;
+        }
+    }
+
+    u32 check = (u32)get_le(&in, 4);
+    u64 screen = get_le(&in, 8);
+    u64 state_hash = get_le(&in, 8);
+    if (check != NETPLAY_NO_CHECK) add_check(check, screen, state_hash, 0);
+}
+
+// Goes back to the first frame that guessed wrong and runs every frame since again
+static void roll_back(struct chip8 *state, enum engine engine)
+{
+    u32 from = net.rollback_from;
+    net.rollback_from = NO_ROLLBACK;
+    if (from >= net.frame) return;
+
+    u64 start_ns = pf_get_time_ns();
+    read_snapshot_payload(state, net.frames[from % NETPLAY_RING].payload);
+    for (u32 frame = from; frame < net.frame; frame++)
+    {
+        struct net_frame *saved = &net.frames[frame % NETPLAY_RING];
+        if (frame > from) save_frame(state, frame);
+        remote_keys(frame, &saved->remote_held, &saved->remote_pressed);
+        if (state->halt) continue;
+
+        set_frame_keys(state, saved->held | saved->remote_held, saved->pressed | saved->remote_pressed);
+        run_engine(state, engine, saved->budget);
+        tick_timers(state);
+    }
+    state->screen_dirty = 1;
+
+    u64 ns = pf_get_time_ns() - start_ns;
+    u32 depth = net.frame - from;
+    net.rollbacks++;
+    net.resimulated += depth;
+    if (depth > net.deepest) net.deepest = depth;
+    net.resim_ns += ns;
+    if (ns > net.resim_max_ns) net.resim_max_ns = ns;
+    if (ns > 1000000000 / FRAME_RATE) net.resim_late++;
+}
+
+// Hashes every checkpoint whose frames can't be rolled back any more
+static void finish_checks()
+{
+    while (net.next_check < net.frame && net.next_check <= net.received)
+    {
+        struct net_frame *saved = &net.frames[net.next_check % NETPLAY_RING];
+        net.sent_check = net.next_check;
+        net.sent_screen = saved->screen_hash;
+        net.sent_state = snapshot_checksum(saved->payload, SNAPSHOT_PAYLOAD_SIZE);
+        add_check(net.sent_check, net.sent_screen, net.sent_state, 1);
+        net.next_check += NETPLAY_HASH_INTERVAL;
+    }
+}
+
+static void drop_link(const char *reason)
+{
+    printf("%s, carrying on alone\n", reason);
+    net.linked = 0;
+    pf_udp_close();
+}
+
+u8 netplay_start(struct chip8 *state, int player, u16 port, u32 *tick_rate)
+{
+    memset(&net, 0, sizeof(net));
+    net.player = player;
+    u16 local = player == 1 ? port : (u16)(port + 1);
+    u16 remote = player == 1 ? (u16)(port + 1) : port;
+    if (!pf_udp_open(local, remote)) return 0;
+
+    // Player 1 decides how the machine starts
+    u8 *payload = net.frames[0].payload;
+    write_snapshot_payload(state, payload);
+    begin_packet(NET_START);
+    put_le(state->random, 8);
+    put_le(*tick_rate, 4);
+    put_le(snapshot_checksum(payload, SNAPSHOT_PAYLOAD_SIZE), 8);
+    memcpy(net.start, net.packet, START_SIZE);
+
+    printf("Player %d on port %d, waiting for player %d\n", player, (int)local, 3 - player);
+    u8 data[PACKET_MAX];
+    u64 give_up = pf_get_time_us() + HANDSHAKE_TIMEOUT_US;
+    u64 next_hello = 0;
+    while (!net.linked && pf_get_time_us() < give_up)
+    {
+        if (player == 2 && pf_get_time_us() >= next_hello)
+        {
+            begin_packet(NET_HELLO);
+            send_packet();
+            next_hello = pf_get_time_us() + HELLO_INTERVAL_US;
+        }
+
+        u32 size;
+        while (!net.linked && (size = pf_udp_receive(data, sizeof(data))) > 0)
+        {
+            if (size < 2) continue;
+            if (data[1] != NETPLAY_VERSION)
+            {
+                printf("Player %d is running a different version of the link\n", 3 - player);
+                pf_udp_close();
+                return 0;
+            }
+
+            if (player == 1 && data[0] == NET_HELLO)
+            {
+                pf_udp_send(net.start, START_SIZE);
+                net.linked = 1;
+            }
+            else if (player == 2 && data[0] == NET_START && size == START_SIZE)
+            {
+                const u8 *in = data + 2;
+                state->random = get_le(&in, 8);
+                *tick_rate = (u32)get_le(&in, 4);
+                u64 hash = get_le(&in, 8);
+
+                write_snapshot_payload(state, payload);
+                if (snapshot_checksum(payload, SNAPSHOT_PAYLOAD_SIZE) != hash)
+                {
+                    printf("Player 1 started from a different rom, font or state\n");
+                    begin_packet(NET_BYE);
+                    send_packet();
+                    pf_udp_close();
+                    return 0;
+                }
+                net.linked = 1;
+            }
+        }
+        if (!net.linked) pf_sleep_until(pf_get_time_us() + 1000);
+    }
+    if (!net.linked)
+    {
+        printf("Player %d never turned up\n", 3 - player);
+        pf_udp_close();
+        return 0;
+    }
+
+    net.rollback_from = NO_ROLLBACK;
+    net.sent_check = NETPLAY_NO_CHECK;
+    net.start_us = pf_get_time_us();
+    net.last_receive_us = net.start_us;
+    printf("Linked as player %d at %" PRIu32 " instructions a second\n", player, *tick_rate);
+    return 1;
+}
+
+void netplay_stop()
+{
+    if (net.linked)
+    {
+        begin_packet(NET_BYE);
+        send_packet();
+        pf_udp_close();
+        net.linked = 0;
+    }
+    if (net.start_us == 0) return;
+
+    f64 seconds = (pf_get_time_us() - net.start_us) / 1000000.0;
+    printf("Link: player %d, %" PRIu32 " frames in %.1f s, waited for player %d %" PRIu64 " times, sent %" PRIu64 " packets and received %" PRIu64 "\n",
+        net.player, net.frame, seconds, 3 - net.player, net.waits, net.sent, net.packets_received);
+    if (net.rollbacks > 0)
+    {
+        printf("  Rollbacks: %" PRIu64 ", %" PRIu64 " frames run again, deepest %" PRIu32 ", mean %.1f us, max %.1f us, %" PRIu64 " took longer than a frame\n",
+            net.rollbacks, net.resimulated, net.deepest, (f64)net.resim_ns / net.rollbacks / 1000.0, net.resim_max_ns / 1000.0, net.resim_late);
+    }
+    if (net.desyncs == 0)
+        printf("  Checks: all %" PRIu64 " matched\n", net.checks_matched);
+    else
+        printf("  Checks: %" PRIu64 " matched, %" PRIu64 " desynced, first at frame %" PRIu32 "\n", net.checks_matched, net.desyncs, net.first_desync);
+
+    memset(&net, 0, sizeof(net));
+}
+
+u8 netplay_waiting()
+{
+    if (!net.linked || net.frame - net.received < NETPLAY_MAX_ROLLBACK) return 0;
+    net.waits++;
+    return 1;
+}
+
+void netplay_frame(struct chip8 *state, u32 budget, u16 *held, u16 *pressed)
+{
+    if (!net.linked) return;
+
+    struct net_frame *saved = &net.frames[net.frame % NETPLAY_RING];
+    save_frame(state, net.frame);
+    saved->budget = budget;
+    saved->held = *held;
+    saved->pressed = *pressed;
+    remote_keys(net.frame, &saved->remote_held, &saved->remote_pressed);
+    *held |= saved->remote_held;
+    *pressed |= saved->remote_pressed;
+    net.frame++;
+}
+
+void netplay_poll(struct chip8 *state, enum engine engine)
+{
+    if (!net.linked) return;
+
+    u8 data[PACKET_MAX];
+    u32 size;
+    while ((size = pf_udp_receive(data, sizeof(data))) > 0)
+    {
+        if (size < 2 || data[1] != NETPLAY_VERSION) continue;
+        net.packets_received++;
+        net.last_receive_us = pf_get_time_us();
+
+        if (data[0] == NET_HELLO && net.player == 1)
+        {
+            pf_udp_send(net.start, START_SIZE);
+        }
+        else if (data[0] == NET_INPUT)
+        {
+            receive_input(data, size);
+        }
+        else if (data[0] == NET_BYE)
+        {
+            drop_link(net.player == 1 ? "Player 2 quit" : "Player 1 quit");
+            return;
+        }
+    }
+
+    u64 now = pf_get_time_us();
+    if (now - net.last_receive_us > LINK_TIMEOUT_US)
+    {
+        drop_link(net.player == 1 ? "Lost player 2" : "Lost player 1");
+        return;
+    }
+
+    roll_back(state, engine);
+    finish_checks();
+    if (net.frame != net.last_sent_frame || now - net.last_send_us >= RESEND_US) send_input();
+}
\ No newline at end of file
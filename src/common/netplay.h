@@ -0,0 +1,64 @@
+#ifndef _NETPLAY_H_
+#define _NETPLAY_H_
+
+#include "types.h"
+#include "engine.h"
+
+/*
+Two player link
+
+Two copies of c8 on the same machine run the same rom in step over UDP, each with its own
+window and keys, and both players' keys are ORed onto the one keypad. Nothing waits on the
+other side: each frame uses the remote keys if they've arrived and otherwise guesses the
+remote player is still holding what they last held. Every frame's starting state is saved,
+and when the real keys for a frame turn out different from the guess the machine goes back
+to that frame and runs forward again to the present with the right keys, so both sides end
+up with identical machines however late the packets are
+
+Player 1 listens on the port and player 2 on the one after. Player 2 says hello until player
+1 answers with the random number generator and tick rate to use and a hash of its starting
+state, so a different rom or font is caught before the first frame
+
+Each side sends every frame it has that the other hasn't acknowledged, and every
+NETPLAY_HASH_INTERVAL frames, once both players' keys for everything before it are known, a
+hash of the screen and the whole state. Those are compared with the other side's and the
+first frame where they differ is reported as a desync
+
+Packets, little endian, start with a type byte and NETPLAY_VERSION
+    NET_HELLO   nothing else
+    NET_START   random u64, tick rate u32, state hash u64
+    NET_INPUT   ack u32 (frames received), first frame u32, count u8, count * (held u16, pressed u16),
+                check frame u32 (NETPLAY_NO_CHECK if there isn't one yet), screen hash u64, state hash u64
+    NET_BYE     nothing else, the other side has quit
+
+A side stops to wait when it's NETPLAY_MAX_ROLLBACK frames ahead of the keys it has, which
+keeps rolling back to at most that many frames
+*/
+
+#define NETPLAY_PORT 28600
+#define NETPLAY_VERSION 1
+#define NETPLAY_MAX_ROLLBACK 8
+#define NETPLAY_RING 32 // Frames of saved state and keys kept, more than two rollbacks' worth
+#define NETPLAY_HASH_INTERVAL 30
+#define NETPLAY_CHECKS 8
+#define NETPLAY_NO_CHECK 0xFFFFFFFF
+#define NETPLAY_POLL_US 2000 // How long to sleep while linked and with nothing to run
+
+struct chip8;
+
+enum netplay_packet
+{
+    NET_HELLO,
+    NET_START,
+    NET_INPUT,
+    NET_BYE,
+};
+
+u8 netplay_start(struct chip8 *state, int player, u16 port, u32 *tick_rate); // Waits for the other player, player 2 takes player 1's generator and tick rate. Returns 0 on failure
+void netplay_stop(); // Tells the other side and prints a report
+u8 netplay_active();
+u8 netplay_waiting(); // Call before a frame, returns 1 if it's too far ahead of the other player to run one
+void netplay_frame(struct chip8 *state, u32 budget, u16 *held, u16 *pressed); // Call at the start of every frame, adds the remote keys
+void netplay_poll(struct chip8 *state, enum engine engine); // Receives keys, rolls back if a guess was wrong and sends ours
+
+#endif //_NETPLAY_H_
\ No newline at end of file
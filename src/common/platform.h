@@ -9,21 +9,116 @@ void init_platform();
 void shutdown_platform();
 
 // Rendering
-void pf_render_screen(struct chip8 *state);
+enum scale_mode
+{
+    SCALE_INTEGER, // Largest whole number scale that fits the window
+    SCALE_FIT, // Fills the window as far as the 2:1 aspect ratio allows
+};
+
+struct render_options
+{
+    enum scale_mode scale;
+    u8 phosphor; // 0 is off, otherwise out of 256 how much of a pixel's brightness is left after each frame it's off
+};
+
+void pf_set_render_options(struct render_options *options); // Call before init_platform
+void pf_render_screen(struct chip8 *state); // Hands a copy of the screen to the render thread, never waits for it to draw
+
+// Sound
+/*
+The emulator queues whether the tone plays once per emulated frame and the audio callback
+plays each queued frame for 1/60 of a second. Frames the callback has no time for are
+dropped when they're queued, and when the queue runs dry the callback keeps the last
+state going for a few frames before going quiet, so neither side ever waits for the other
+whatever speed emulation runs at
+*/
+struct audio_options
+{
+    u16 buffer_samples; // Samples per callback, smaller is lower latency, 0 turns sound off
+};
+
+void pf_set_audio_options(struct audio_options *options); // Call before init_platform
+void pf_queue_sound(u8 on); // Never blocks
 
 // Events
+#define PF_WAIT_FOREVER ((u64)-1)
+
 u8 pf_poll_events(); // Returns 0 if program should exit
-u8 pf_get_key_pressed(int scancode);
-u8 pf_get_key_released(int scancode);
-u8 pf_get_key_held(int scancode);
+u8 pf_wait_events(u64 deadline_us); // Sleeps until an event arrives or pf_get_time_us reaches deadline_us, returns 0 if program should exit
 
-// Time
-u64 pf_get_time_us();
+// Input
+/*
+Host keys are turned into chip-8 keypad bits and hotkey bits as events arrive, through a
+keymap loaded from a text file. Each line is a chip-8 key (0-F) or a hotkey name followed
+by an SDL scancode name, # starts a comment
+
+1 1
+C 4
+pause P
+
+Pressed and released bits build up over any number of polls until pf_take_input hands
+them over, so a tap between two frames is never lost
+*/
+enum hotkey
+{
+    HOTKEY_PAUSE,
+    HOTKEY_STEP_FRAME,
+    HOTKEY_STEP_INSTRUCTION,
+    HOTKEY_TURBO,
+    HOTKEY_SLOWER,
+    HOTKEY_FASTER,
+    HOTKEY_NORMAL_SPEED,
+    HOTKEY_SAVE_STATE,
+    HOTKEY_LOAD_STATE,
+    HOTKEY_PREVIOUS_SLOT,
+    HOTKEY_NEXT_SLOT,
+    HOTKEY_REWIND,
+    HOTKEY_COUNT
+};
 
-// Maths
-int pf_rand();
+struct input
+{
+    u16 held; // Bit n is chip-8 key n
+    u16 pressed; // Since the last pf_take_input
+    u16 released;
+    u32 hotkeys; // Bit n is set if hotkey n was pressed
+    u32 hotkeys_held; // Bit n is set while hotkey n is down
+    u64 first_event_us; // pf_get_time_us of the earliest keypad press or release handed over, 0 if there wasn't one
+};
+
+u8 pf_load_keymap(const char *path); // Returns 0 on failure, call after init_platform
+void pf_take_input(struct input *input); // Clears pressed, released, hotkeys and first_event_us
+
+// Time, on the host's monotonic clock
+u64 pf_get_time_ns();
+u64 pf_get_time_us();
+u64 pf_get_cpu_time_us(); // CPU time used by every thread in the process
+void pf_sleep_until(u64 deadline_us); // Returns straight away if deadline_us has passed
 
 // Files
+#define PF_MAX_PATH 512
+
 u8 pf_mkdir(const char *path);
+u8 pf_write_file(const char *path, const u8 *data, u32 size); // Writes a temporary file and renames it over path, so path is never half written
+u8 pf_write_file_async(const char *path, const u8 *data, u32 size); // Copies data and writes it on another thread, returns 0 if the last one hasn't finished
+
+// Network, one UDP socket talking to another process on this machine
+u8 pf_udp_open(u16 local_port, u16 remote_port); // Returns 0 on failure
+void pf_udp_close();
+u8 pf_udp_send(const u8 *data, u32 size); // Returns 0 if it couldn't be sent, nothing is retried
+u32 pf_udp_receive(u8 *data, u32 capacity); // Returns the size of the next datagram, 0 if none are waiting
+
+// Threads, for running many machines at once
+#define PF_MAX_THREADS 64
+
+u32 pf_cpu_count(); // Logical processors online
+u8 pf_run_threads(u32 count, void (*work)(u32 index, void *data), void *data); // Runs work with index 0 to count - 1 on count threads, 0 on this one, and waits for them all. Returns 0 if any couldn't be started
+void pf_yield(); // Gives the rest of this thread's time slice to another thread
+
+// Atomics, sequentially consistent
+i64 pf_atomic_load(volatile i64 *value);
+void pf_atomic_store(volatile i64 *value, i64 desired);
+u8 pf_atomic_cas(volatile i64 *value, i64 expected, i64 desired); // Returns 1 if value held expected and now holds desired
+i64 pf_atomic_add(volatile i64 *value, i64 amount); // Returns the new value
 
 #endif //_PLATFORM_H_
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "platform.h"
+#include "platform_os.h"
+#include "types.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h> // mkdir
+#include <sys/timerfd.h>
+
+struct os_state
+{
+    int timer; // timerfd on CLOCK_MONOTONIC, -1 if it couldn't be created
+    int socket; // -1 when closed
+};
+
+static struct os_state os_state = { -1, -1 };
+
+void os_init()
+{
+    os_state.timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (os_state.timer < 0)
+    {
+        printf("Failed to create frame timer, sleeping with clock_nanosleep: %s\n", strerror(errno));
+    }
+}
+
+void os_shutdown()
+{
+    if (os_state.timer >= 0) close(os_state.timer);
+    os_state.timer = -1;
+    pf_udp_close();
+}
+
+u64 pf_get_time_ns()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u64)time.tv_sec * 1000000000 + (u64)time.tv_nsec;
+}
+
+u64 pf_get_time_us()
+{
+    return pf_get_time_ns() / 1000;
+}
+
+u64 pf_get_cpu_time_us()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return (u64)time.tv_sec * 1000000 + (u64)time.tv_nsec / 1000;
+}
+
+void pf_sleep_until(u64 deadline_us)
+{
+    // Absolute deadline on the same clock as pf_get_time_us, so a late wake up never adds up
+    struct timespec deadline;
+    deadline.tv_sec = (time_t)(deadline_us / 1000000);
+    deadline.tv_nsec = (long)(deadline_us % 1000000 * 1000);
+
+    if (os_state.timer >= 0)
+    {
+        struct itimerspec timer;
+        memset(&timer, 0, sizeof(timer));
+        timer.it_value = deadline;
+        if (timerfd_settime(os_state.timer, TFD_TIMER_ABSTIME, &timer, NULL) == 0)
+        {
+            // A deadline that has already passed expires straight away
+            u64 expirations;
+            while (read(os_state.timer, &expirations, sizeof(expirations)) < 0 && errno == EINTR);
+            return;
+        }
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+}
+
+u8 pf_mkdir(const char *path)
+{
+    if (mkdir(path, 0755) == 0) return 1;
+    return 0;
+}
+
+u8 pf_write_file(const char *path, const u8 *data, u32 size)
+{
+    char temporary[PF_MAX_PATH + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    int file = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (file < 0)
+    {
+        printf("Failed to open %s: %s\n", temporary, strerror(errno));
+        return 0;
+    }
+
+    u32 offset = 0;
+    while (offset < size)
+    {
+        ssize_t written = write(file, data + offset, size - offset);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0)
+        {
+            printf("Failed to write %s: %s\n", temporary, strerror(errno));
+            close(file);
+            unlink(temporary);
+            return 0;
+        }
+        offset += (u32)written;
+    }
+
+    // rename replaces path in one step, anything reading it sees the old file or the new one
+    if (close(file) != 0 || rename(temporary, path) != 0)
+    {
+        printf("Failed to replace %s: %s\n", path, strerror(errno));
+        unlink(temporary);
+        return 0;
+    }
+    return 1;
+}
+
+static struct sockaddr_in loopback(u16 port)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+u8 pf_udp_open(u16 local_port, u16 remote_port)
+{
+    pf_udp_close();
+    os_state.socket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (os_state.socket < 0)
+    {
+        printf("Failed to create a socket: %s\n", strerror(errno));
+        return 0;
+    }
+
+    // Connecting means send and recv only ever talk to the other process
+    struct sockaddr_in local = loopback(local_port);
+    struct sockaddr_in remote = loopback(remote_port);
+    if (bind(os_state.socket, (struct sockaddr *)&local, sizeof(local)) != 0 ||
+        connect(os_state.socket, (struct sockaddr *)&remote, sizeof(remote)) != 0)
+    {
+        printf("Failed to open UDP port %d: %s\n", (int)local_port, strerror(errno));
+        pf_udp_close();
+        return 0;
+    }
+    return 1;
+}
+
+void pf_udp_close()
+{
+    if (os_state.socket >= 0) close(os_state.socket);
+    os_state.socket = -1;
+}
+
+u8 pf_udp_send(const u8 *data, u32 size)
+{
+    if (os_state.socket < 0) return 0;
+    return send(os_state.socket, data, size, 0) == (ssize_t)size;
+}
+
+u32 pf_udp_receive(u8 *data, u32 capacity)
+{
+    if (os_state.socket < 0) return 0;
+    while (1)
+    {
+        ssize_t size = recv(os_state.socket, data, capacity, 0);
+        if (size > 0) return (u32)size;
+        // Refused means an earlier send found nobody listening yet, anything else means nothing is waiting
+        if (size < 0 && (errno == EINTR || errno == ECONNREFUSED)) continue;
+        return 0;
+    }
+}
+
+u32 pf_cpu_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (u32)count : 1;
+}
+
+struct thread_start
+{
+    void (*work)(u32 index, void *data);
+    void *data;
+    u32 index;
+};
+
+static void *thread_main(void *start)
+{
+    struct thread_start *thread = start;
+    thread->work(thread->index, thread->data);
+    return NULL;
+}
+
+u8 pf_run_threads(u32 count, void (*work)(u32 index, void *data), void *data)
+{
+    if (count == 0 || count > PF_MAX_THREADS) return 0;
+
+    pthread_t threads[PF_MAX_THREADS];
+    struct thread_start starts[PF_MAX_THREADS];
+    u32 started = 1;
+    u8 ok = 1;
+    for (u32 i = 1; i < count; i++)
+    {
+        starts[started].work = work;
+        starts[started].data = data;
+        starts[started].index = i;
+        int error = pthread_create(&threads[started], NULL, thread_main, &starts[started]);
+        if (error != 0)
+        {
+            printf("Failed to start thread %" PRIu32 ": %s\n", i, strerror(error));
+            ok = 0;
+            break;
+        }
+        started++;
+    }
+
+    work(0, data);
+    for (u32 i = 1; i < started; i++) pthread_join(threads[i], NULL);
+    return ok;
+}
+
+void pf_yield()
+{
+    sched_yield();
+}
+
+i64 pf_atomic_load(volatile i64 *value)
+{
+    return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+}
+
+void pf_atomic_store(volatile i64 *value, i64 desired)
+{
+    __atomic_store_n(value, desired, __ATOMIC_SEQ_CST);
+}
+
+u8 pf_atomic_cas(volatile i64 *value, i64 expected, i64 desired)
+{
+    return __atomic_compare_exchange_n(value, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+i64 pf_atomic_add(volatile i64 *value, i64 amount)
+{
+    return __atomic_add_fetch(value, amount, __ATOMIC_SEQ_CST);
+}
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "platform.h"
+#include "platform_os.h"
+#include "chip8.h"
+#include "types.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+Null platform backend used by the headless runner
+
+There is no window, no input and no pacing, rendering is a no-op
+so the interpreter can be run as fast as the host allows
+
+The clock and files come from the same OS backend c8 uses
+*/
+
+void init_platform()
+{
+    os_init();
+}
+
+void shutdown_platform()
+{
+    os_shutdown();
+}
+
+void pf_set_render_options(struct render_options *options)
+{
+}
+
+void pf_render_screen(struct chip8 *state)
+{
+}
+
+void pf_set_audio_options(struct audio_options *options)
+{
+}
+
+void pf_queue_sound(u8 on)
+{
+}
+
+u8 pf_poll_events()
+{
+    return 1;
+}
+
+u8 pf_wait_events(u64 deadline_us)
+{
+    // No events will ever arrive, only deadlines end the wait
+    if (deadline_us == PF_WAIT_FOREVER) return 0;
+
+    pf_sleep_until(deadline_us);
+    return 1;
+}
+
+u8 pf_load_keymap(const char *path)
+{
+    return 1;
+}
+
+void pf_take_input(struct input *input)
+{
+    memset(input, 0, sizeof(*input));
+}
+
+u8 pf_write_file_async(const char *path, const u8 *data, u32 size)
+{
+    // Nothing is waiting on a frame, so the write happens straight away
+    return pf_write_file(path, data, size);
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#ifndef _PLATFORM_OS_H_
+#define _PLATFORM_OS_H_
+
+#include "types.h"
+
+/*
+Operating system half of the platform layer
+
+platform_sdl.c and platform_null.c provide the window, rendering, sound and input, and
+init_platform / shutdown_platform call into one OS backend for the clock, sleeping, CPU
+time, files, sockets and threads. The backend is picked with C8_OS_BACKEND in CMakeLists.txt
+
+platform_linux.c: clock_gettime, timerfd, POSIX files, BSD sockets, pthreads and GCC atomics
+platform_win32.c: QueryPerformanceCounter, waitable timers, the CRT's files, Winsock, Win32 threads and Interlocked functions
+
+Each one defines the pf_ functions under Time, Files, Network, Threads and Atomics in platform.h
+*/
+
+void os_init();
+void os_shutdown();
+
+#endif //_PLATFORM_OS_H_
\ No newline at end of file
@@ -0,0 +1,679 @@
+#include "platform.h"
+#include "platform_os.h"
+#include "chip8.h"
+#include "types.h"
+#include "triple_buffer.h"
+#include "sound_queue.h"
+#include "timer.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SOUND_FREQUENCY 44100
+#define SOUND_TONE_HZ 440
+#define SOUND_VOLUME 3000
+#define SOUND_MAX_HOLD 8 // Frames the last state keeps playing once the queue runs dry
+#define SOUND_FILL_BUCKETS 16
+
+#define KEYMAP_NONE 0xFF
+#define KEYMAP_HOTKEY 0x10 // Bindings below this are chip-8 keys, from it up hotkeys
+
+struct sdl_state
+{
+    SDL_Window *window;
+};
+
+// The renderer belongs to the render thread, emulation only publishes frames to it
+struct render_state
+{
+    SDL_Thread *thread;
+    SDL_sem *wake;
+    SDL_atomic_t quit;
+    struct triple_buffer frames;
+    struct render_options options;
+
+    u32 expand[256][8]; // ARGB8888 pixels for every byte of a screen row
+    u32 grey[256]; // ARGB8888 for each phosphor brightness
+    u8 glow[DISPLAY_SIZE]; // Phosphor brightness of each pixel
+
+    // Stats
+    u64 frames_drawn;
+    u64 draw_calls;
+    u64 draw_ticks; // Performance counter ticks spent drawing, not counting present
+};
+
+// The playback fields belong to the audio callback, the emulator only pushes to the queue
+struct audio_state
+{
+    SDL_AudioDeviceID device;
+    struct audio_options options;
+    struct sound_queue queue;
+    u32 queue_limit; // Frames the emulator may have queued, enough to cover a callback and a bit
+    u64 dropped; // Frames the emulator queued while the queue was at the limit
+
+    u32 frame_samples;
+    u32 frame_remainder; // Samples per frame is frame_samples plus a carry of frame_remainder / FRAME_RATE
+    u32 carry;
+    u32 samples_left; // In the frame being played
+    u32 phase;
+    u32 phase_step;
+    u8 on;
+    u8 held; // Frames played again because the queue was empty
+
+    // Stats
+    u64 callbacks;
+    u64 frames_played;
+    u64 underruns;
+    u64 fill[SOUND_FILL_BUCKETS]; // Frames waiting at the start of each callback, the last bucket takes everything above
+};
+
+// Save states and the like are written on their own thread so a slow disk never holds up a frame
+struct writer_state
+{
+    SDL_Thread *thread;
+    SDL_sem *wake;
+    SDL_atomic_t busy; // Set from when a write is handed over until it's finished
+    SDL_atomic_t quit;
+    char path[PF_MAX_PATH];
+    u8 *data;
+    u32 size;
+    u32 capacity;
+};
+
+struct input_state
+{
+    u8 keymap[SDL_NUM_SCANCODES]; // Binding of every scancode
+    u16 held;
+    u16 pressed;
+    u16 released;
+    u32 hotkeys;
+    u32 hotkeys_held;
+    u64 first_event_us;
+    u64 ticks_offset_us; // Turns SDL event timestamps into pf_get_time_us
+};
+
+static struct sdl_state sdl_state;
+static struct input_state input_state;
+static struct render_state render_state;
+static struct audio_state audio_state;
+static struct writer_state writer_state;
+
+static const char *hotkey_names[HOTKEY_COUNT] = {
+    "pause",
+    "step_frame",
+    "step_instruction",
+    "turbo",
+    "slower",
+    "faster",
+    "normal_speed",
+    "save",
+    "load",
+    "previous_slot",
+    "next_slot",
+    "rewind",
+};
+
+static void init_render_tables()
+{
+    for (int byte = 0; byte < 256; byte++)
+    {
+        for (int bit = 0; bit < 8; bit++)
+        {
+            render_state.expand[byte][bit] = ((byte >> (7 - bit)) & 0x1) ? 0xFFFFFFFF : 0xFF000000;
+        }
+    }
+    for (int level = 0; level < 256; level++)
+    {
+        render_state.grey[level] = 0xFF000000 | ((u32)level << 16) | ((u32)level << 8) | (u32)level;
+    }
+    memset(render_state.glow, 0, sizeof(render_state.glow));
+}
+
+// Expands the packed screen into ARGB8888 texture memory, returns whether any pixel is still fading
+static u8 expand_frame(struct frame *frame, u8 *pixels, int pitch)
+{
+    u8 fading = 0;
+    u32 keep = render_state.options.phosphor;
+    for (int y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        u32 *out = (u32 *)(pixels + y * pitch);
+        u64 row = frame->rows[y];
+        if (keep == 0)
+        {
+            // One table lookup and an 8 pixel copy per byte of the row
+            for (int byte = 0; byte < 8; byte++)
+            {
+                memcpy(out + 8 * byte, render_state.expand[(row >> (56 - 8 * byte)) & 0xFF], sizeof(render_state.expand[0]));
+            }
+        }
+        else
+        {
+            // Lit pixels are full brightness, unlit ones fade a little every frame
+            u8 *glow = &render_state.glow[y * DISPLAY_WIDTH];
+            for (int x = 0; x < DISPLAY_WIDTH; x++, row <<= 1)
+            {
+                u8 level = (row & PIXEL_BIT(0)) ? 255 : (u8)((glow[x] * keep) >> 8);
+                fading |= (level != 0 && level != 255);
+                glow[x] = level;
+                out[x] = render_state.grey[level];
+            }
+        }
+    }
+    return fading;
+}
+
+// Where the 64x32 texture goes in the window
+static void screen_rect(SDL_Renderer *renderer, SDL_Rect *rect)
+{
+    int w, h;
+    SDL_GetRendererOutputSize(renderer, &w, &h);
+
+    if (render_state.options.scale == SCALE_INTEGER)
+    {
+        int scale = w / DISPLAY_WIDTH < h / DISPLAY_HEIGHT ? w / DISPLAY_WIDTH : h / DISPLAY_HEIGHT;
+        if (scale < 1) scale = 1;
+        rect->w = DISPLAY_WIDTH * scale;
+        rect->h = DISPLAY_HEIGHT * scale;
+    }
+    else if (w * DISPLAY_HEIGHT > h * DISPLAY_WIDTH)
+    {
+        // Window is wider than the screen
+        rect->h = h;
+        rect->w = h * DISPLAY_WIDTH / DISPLAY_HEIGHT;
+    }
+    else
+    {
+        rect->w = w;
+        rect->h = w * DISPLAY_HEIGHT / DISPLAY_WIDTH;
+    }
+    rect->x = (w - rect->w) / 2;
+    rect->y = (h - rect->h) / 2;
+}
+
+static u8 draw_frame(SDL_Renderer *renderer, SDL_Texture *texture, struct frame *frame)
+{
+    u64 start = SDL_GetPerformanceCounter();
+
+    void *pixels;
+    int pitch;
+    u8 fading = 0;
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) == 0)
+    {
+        fading = expand_frame(frame, (u8 *)pixels, pitch);
+        SDL_UnlockTexture(texture);
+    }
+
+    SDL_Rect rect;
+    screen_rect(renderer, &rect);
+    SDL_RenderClear(renderer);
+    SDL_RenderCopy(renderer, texture, NULL, &rect);
+
+    render_state.draw_ticks += SDL_GetPerformanceCounter() - start;
+    render_state.draw_calls += 2;
+    render_state.frames_drawn++;
+
+    SDL_RenderPresent(renderer); // May block on vsync, only this thread waits
+    return fading;
+}
+
+static int render_thread(void *data)
+{
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+    SDL_Renderer *renderer = SDL_CreateRenderer(sdl_state.window, -1, SDL_RENDERER_PRESENTVSYNC);
+    if (renderer == NULL)
+    {
+        printf("Failed to create renderer: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    if (texture == NULL)
+    {
+        printf("Failed to create screen texture: %s\n", SDL_GetError());
+        SDL_DestroyRenderer(renderer);
+        return 1;
+    }
+    init_render_tables();
+
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderClear(renderer);
+    SDL_RenderPresent(renderer);
+
+    struct frame *frame = NULL;
+    u8 fading = 0;
+    while (!SDL_AtomicGet(&render_state.quit))
+    {
+        // Keep presenting the last frame at about 60Hz while the phosphor fades out
+        if (fading)
+            SDL_SemWaitTimeout(render_state.wake, 16);
+        else
+            SDL_SemWait(render_state.wake);
+
+        struct frame *newest = tb_acquire(&render_state.frames);
+        if (newest != NULL) frame = newest;
+        if (frame != NULL && (newest != NULL || fading)) fading = draw_frame(renderer, texture, frame);
+    }
+
+    if (render_state.frames_drawn > 0)
+    {
+        f64 us = 1000000.0 * render_state.draw_ticks / SDL_GetPerformanceFrequency() / render_state.frames_drawn;
+        printf("Rendered %" PRIu64 " frames, %.1f draw calls and %.1f us per frame before present\n",
+            render_state.frames_drawn, (f64)render_state.draw_calls / render_state.frames_drawn, us);
+    }
+
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+    return 0;
+}
+
+// Moves on to the next queued frame, or keeps the last one going if the emulator is behind
+static void next_sound_frame()
+{
+    u8 on;
+    if (sq_pop(&audio_state.queue, &on))
+    {
+        audio_state.on = on;
+        audio_state.held = 0;
+        audio_state.frames_played++;
+    }
+    else
+    {
+        audio_state.underruns++;
+        if (audio_state.held < SOUND_MAX_HOLD)
+            audio_state.held++;
+        else
+            audio_state.on = 0;
+    }
+
+    audio_state.samples_left = audio_state.frame_samples;
+    audio_state.carry += audio_state.frame_remainder;
+    if (audio_state.carry >= FRAME_RATE)
+    {
+        audio_state.carry -= FRAME_RATE;
+        audio_state.samples_left++;
+    }
+}
+
+static void SDLCALL audio_callback(void *data, Uint8 *stream, int length)
+{
+    audio_state.callbacks++;
+    u32 waiting = sq_count(&audio_state.queue);
+    audio_state.fill[waiting < SOUND_FILL_BUCKETS ? waiting : SOUND_FILL_BUCKETS - 1]++;
+
+    // Square wave, the phase keeps running through silence so the tone never clicks in half way
+    Sint16 *out = (Sint16 *)stream;
+    int count = length / (int)sizeof(Sint16);
+    for (int n = 0; n < count; n++)
+    {
+        if (audio_state.samples_left == 0) next_sound_frame();
+        audio_state.samples_left--;
+
+        Sint16 level = (audio_state.phase & 0x80000000) ? SOUND_VOLUME : -SOUND_VOLUME;
+        out[n] = audio_state.on ? level : 0;
+        audio_state.phase += audio_state.phase_step;
+    }
+}
+
+static void open_audio()
+{
+    sq_init(&audio_state.queue);
+    audio_state.device = 0;
+    if (audio_state.options.buffer_samples == 0) return;
+
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = SOUND_FREQUENCY;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = audio_state.options.buffer_samples;
+    want.callback = audio_callback;
+
+    audio_state.device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+    if (audio_state.device == 0)
+    {
+        printf("Failed to open audio device, running without sound: %s\n", SDL_GetError());
+        return;
+    }
+
+    audio_state.frame_samples = (u32)have.freq / FRAME_RATE;
+    audio_state.frame_remainder = (u32)have.freq % FRAME_RATE;
+    audio_state.phase_step = (u32)(((u64)SOUND_TONE_HZ << 32) / (u64)have.freq);
+    audio_state.queue_limit = have.samples / audio_state.frame_samples + 2;
+    if (audio_state.queue_limit >= SOUND_QUEUE_SIZE) audio_state.queue_limit = SOUND_QUEUE_SIZE - 1;
+    printf("Audio: %d Hz, %d samples per callback, up to %" PRIu32 " frames queued\n", have.freq, (int)have.samples, audio_state.queue_limit);
+
+    SDL_PauseAudioDevice(audio_state.device, 0);
+}
+
+static void close_audio()
+{
+    if (audio_state.device == 0) return;
+    SDL_CloseAudioDevice(audio_state.device);
+
+    printf("Audio: %" PRIu64 " callbacks, played %" PRIu64 " frames, %" PRIu64 " underruns, dropped %" PRIu64 " frames\n",
+        audio_state.callbacks, audio_state.frames_played, audio_state.underruns, audio_state.dropped);
+    if (audio_state.callbacks == 0) return;
+    printf("Frames queued at each callback:\n");
+    for (int bucket = 0; bucket < SOUND_FILL_BUCKETS; bucket++)
+    {
+        if (audio_state.fill[bucket] == 0) continue;
+        printf("  %2d%s %10" PRIu64 " %5.1f%%\n", bucket, bucket == SOUND_FILL_BUCKETS - 1 ? "+" : " ",
+            audio_state.fill[bucket], 100.0 * audio_state.fill[bucket] / audio_state.callbacks);
+    }
+}
+
+void pf_set_audio_options(struct audio_options *options)
+{
+    audio_state.options = *options;
+}
+
+void pf_queue_sound(u8 on)
+{
+    if (audio_state.device == 0) return;
+
+    // Past the limit the callback couldn't play it before it's stale, turbo drops most frames here
+    if (sq_count(&audio_state.queue) >= audio_state.queue_limit || !sq_push(&audio_state.queue, on))
+    {
+        audio_state.dropped++;
+    }
+}
+
+static int writer_thread(void *data)
+{
+    while (1)
+    {
+        SDL_SemWait(writer_state.wake);
+        if (SDL_AtomicGet(&writer_state.busy))
+        {
+            u64 start = pf_get_time_us();
+            if (pf_write_file(writer_state.path, writer_state.data, writer_state.size))
+            {
+                printf("Wrote %s, %" PRIu32 " bytes in %.1f ms\n", writer_state.path, writer_state.size, (pf_get_time_us() - start) / 1000.0);
+            }
+            SDL_AtomicSet(&writer_state.busy, 0);
+        }
+        if (SDL_AtomicGet(&writer_state.quit)) break;
+    }
+    return 0;
+}
+
+u8 pf_write_file_async(const char *path, const u8 *data, u32 size)
+{
+    if (SDL_AtomicGet(&writer_state.busy)) return 0;
+    if (strlen(path) >= sizeof(writer_state.path))
+    {
+        printf("Path is too long to write: %s\n", path);
+        return 0;
+    }
+
+    // Only grows, so after the first write of a size nothing is allocated
+    if (size > writer_state.capacity)
+    {
+        u8 *grown = realloc(writer_state.data, size);
+        if (grown == NULL) return 0;
+        writer_state.data = grown;
+        writer_state.capacity = size;
+    }
+    memcpy(writer_state.data, data, size);
+    writer_state.size = size;
+    strcpy(writer_state.path, path);
+
+    SDL_AtomicSet(&writer_state.busy, 1);
+    SDL_SemPost(writer_state.wake);
+    return 1;
+}
+
+void pf_set_render_options(struct render_options *options)
+{
+    render_state.options = *options;
+}
+
+void init_platform()
+{
+    os_init();
+
+    // SDl
+    SDL_SetMainReady();
+    SDL_Init(SDL_INIT_EVERYTHING);
+    sdl_state.window = SDL_CreateWindow("chip8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, SDL_WINDOW_RESIZABLE);
+
+    // Render thread
+    tb_init(&render_state.frames);
+    SDL_AtomicSet(&render_state.quit, 0);
+    render_state.wake = SDL_CreateSemaphore(0);
+    render_state.thread = SDL_CreateThread(render_thread, "render", NULL);
+
+    open_audio();
+
+    // File writer thread
+    SDL_AtomicSet(&writer_state.busy, 0);
+    SDL_AtomicSet(&writer_state.quit, 0);
+    writer_state.wake = SDL_CreateSemaphore(0);
+    writer_state.thread = SDL_CreateThread(writer_thread, "writer", NULL);
+
+    // Event timestamps are SDL_GetTicks milliseconds
+    memset(input_state.keymap, KEYMAP_NONE, sizeof(input_state.keymap));
+    input_state.ticks_offset_us = pf_get_time_us() - (u64)SDL_GetTicks() * 1000;
+}
+
+void shutdown_platform()
+{
+    close_audio();
+
+    // A write that's been handed over still finishes
+    SDL_AtomicSet(&writer_state.quit, 1);
+    SDL_SemPost(writer_state.wake);
+    SDL_WaitThread(writer_state.thread, NULL);
+    SDL_DestroySemaphore(writer_state.wake);
+    free(writer_state.data);
+    writer_state.data = NULL;
+    writer_state.capacity = 0;
+
+    SDL_AtomicSet(&render_state.quit, 1);
+    SDL_SemPost(render_state.wake);
+    SDL_WaitThread(render_state.thread, NULL);
+    SDL_DestroySemaphore(render_state.wake);
+
+    SDL_DestroyWindow(sdl_state.window);
+    SDL_Quit();
+
+    os_shutdown();
+}
+
+void pf_render_screen(struct chip8 *state)
+{
+    struct frame *frame = tb_write_frame(&render_state.frames);
+    memcpy(frame->rows, state->screen, sizeof(frame->rows));
+    tb_publish(&render_state.frames);
+
+    // One pending wake up is enough, the render thread always takes the newest frame
+    if (SDL_SemValue(render_state.wake) == 0) SDL_SemPost(render_state.wake);
+}
+
+static void handle_key(SDL_KeyboardEvent *key)
+{
+    if (key->repeat) return; // Only the first down of a held key is an edge
+    if ((u32)key->keysym.scancode >= SDL_NUM_SCANCODES) return;
+
+    u8 binding = input_state.keymap[key->keysym.scancode];
+    if (binding == KEYMAP_NONE) return;
+
+    if (binding >= KEYMAP_HOTKEY)
+    {
+        u32 bit = (u32)1 << (binding - KEYMAP_HOTKEY);
+        if (key->type == SDL_KEYDOWN)
+        {
+            input_state.hotkeys |= bit;
+            input_state.hotkeys_held |= bit;
+        }
+        else
+        {
+            input_state.hotkeys_held &= ~bit;
+        }
+        return;
+    }
+
+    u16 bit = KEY_BIT(binding);
+    if (key->type == SDL_KEYDOWN)
+    {
+        input_state.held |= bit;
+        input_state.pressed |= bit;
+    }
+    else
+    {
+        input_state.held &= ~bit;
+        input_state.released |= bit;
+    }
+
+    u64 time = (u64)key->timestamp * 1000 + input_state.ticks_offset_us;
+    if (input_state.first_event_us == 0 || time < input_state.first_event_us) input_state.first_event_us = time;
+}
+
+// Returns 0 if program should exit
+static u8 handle_event(SDL_Event *event)
+{
+    switch(event->type)
+    {
+    case SDL_QUIT:
+        return 0;
+        break;
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        handle_key(&event->key);
+        break;
+    }
+    return 1;
+}
+
+u8 pf_poll_events()
+{
+    SDL_Event event;
+    while (SDL_PollEvent(&event))
+    {
+        if (!handle_event(&event)) return 0;
+    }
+    return 1;
+}
+
+u8 pf_wait_events(u64 deadline_us)
+{
+    SDL_Event event;
+    int got;
+    if (deadline_us == PF_WAIT_FOREVER)
+    {
+        got = SDL_WaitEvent(&event);
+    }
+    else
+    {
+        // SDL only waits whole milliseconds, it takes the bulk of the wait and the OS timer the
+        // last part so the frame starts on time
+        u64 now = pf_get_time_us();
+        got = 0;
+        if (now + 1000 <= deadline_us)
+        {
+            got = SDL_WaitEventTimeout(&event, (int)((deadline_us - now) / 1000));
+        }
+        if (!got)
+        {
+            pf_sleep_until(deadline_us);
+            got = SDL_PollEvent(&event);
+        }
+    }
+
+    // Everything else that arrived with it
+    while (got)
+    {
+        if (!handle_event(&event)) return 0;
+        got = SDL_PollEvent(&event);
+    }
+    return 1;
+}
+
+// Binding for the first word of a keymap line, KEYMAP_NONE if it isn't a key or hotkey
+static u8 parse_binding(const char *name)
+{
+    if (name[0] != '\0' && name[1] == '\0')
+    {
+        char c = name[0];
+        if (c >= '0' && c <= '9') return (u8)(c - '0');
+        if (c >= 'A' && c <= 'F') return (u8)(c - 'A' + 0xA);
+        if (c >= 'a' && c <= 'f') return (u8)(c - 'a' + 0xA);
+    }
+    for (int hotkey = 0; hotkey < HOTKEY_COUNT; hotkey++)
+    {
+        if (strcmp(name, hotkey_names[hotkey]) == 0) return (u8)(KEYMAP_HOTKEY + hotkey);
+    }
+    return KEYMAP_NONE;
+}
+
+u8 pf_load_keymap(const char *path)
+{
+    printf("Loading keymap: %s\n", path);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        printf("Failed to open keymap file: %s\n", path);
+        return 0;
+    }
+
+    memset(input_state.keymap, KEYMAP_NONE, sizeof(input_state.keymap));
+
+    char line[128];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment != NULL) *comment = '\0';
+
+        // First word is the binding, the rest of the line is the scancode name which may contain spaces
+        char *name = strtok(line, " \t\r\n");
+        if (name == NULL) continue;
+        char *scancode_name = strtok(NULL, "\r\n");
+        while (scancode_name != NULL && (*scancode_name == ' ' || *scancode_name == '\t')) scancode_name++;
+        if (scancode_name != NULL)
+        {
+            char *end = scancode_name + strlen(scancode_name);
+            while (end > scancode_name && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+        }
+
+        u8 binding = parse_binding(name);
+        if (binding == KEYMAP_NONE)
+        {
+            printf("Keymap line %d: unknown key or hotkey \"%s\"\n", line_number, name);
+            fclose(file);
+            return 0;
+        }
+
+        SDL_Scancode scancode = scancode_name ? SDL_GetScancodeFromName(scancode_name) : SDL_SCANCODE_UNKNOWN;
+        if (scancode == SDL_SCANCODE_UNKNOWN)
+        {
+            printf("Keymap line %d: unknown scancode \"%s\"\n", line_number, scancode_name ? scancode_name : "");
+            fclose(file);
+            return 0;
+        }
+        input_state.keymap[scancode] = binding;
+    }
+    printf("\n");
+
+    fclose(file);
+    return 1;
+}
+
+void pf_take_input(struct input *input)
+{
+    input->held = input_state.held;
+    input->pressed = input_state.pressed;
+    input->released = input_state.released;
+    input->hotkeys = input_state.hotkeys;
+    input->hotkeys_held = input_state.hotkeys_held;
+    input->first_event_us = input_state.first_event_us;
+
+    input_state.pressed = 0;
+    input_state.released = 0;
+    input_state.hotkeys = 0;
+    input_state.first_event_us = 0;
+}
\ No newline at end of file
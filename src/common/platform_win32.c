@@ -0,0 +1,279 @@
+#include "platform.h"
+#include "platform_os.h"
+#include "types.h"
+
+#include <winsock2.h> // Before Windows.h, which would pull in the old winsock.h
+#include <Windows.h> // QPC, waitable timers
+#include <direct.h> // _mkdir
+#include <stdio.h>
+#include <string.h>
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+struct os_state
+{
+    u64 frequency; // QPC ticks per second
+    HANDLE timer;
+    SOCKET socket;
+    u8 winsock; // Whether WSAStartup has been called
+};
+
+static struct os_state os_state = { 0, NULL, INVALID_SOCKET, 0 };
+
+void os_init()
+{
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    os_state.frequency = (u64)f.QuadPart;
+
+    // High resolution timers need Windows 10 1803, older versions get the default 1-15ms one
+    os_state.timer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (os_state.timer == NULL) os_state.timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+}
+
+void os_shutdown()
+{
+    if (os_state.timer != NULL) CloseHandle(os_state.timer);
+    os_state.timer = NULL;
+    pf_udp_close();
+    if (os_state.winsock) WSACleanup();
+    os_state.winsock = 0;
+}
+
+// Whole seconds and the remainder are scaled separately so the multiply never overflows
+static u64 ticks_to(u64 ticks, u64 units_per_second)
+{
+    return ticks / os_state.frequency * units_per_second + ticks % os_state.frequency * units_per_second / os_state.frequency;
+}
+
+u64 pf_get_time_ns()
+{
+    LARGE_INTEGER time;
+    QueryPerformanceCounter(&time);
+    return ticks_to((u64)time.QuadPart, 1000000000);
+}
+
+u64 pf_get_time_us()
+{
+    LARGE_INTEGER time;
+    QueryPerformanceCounter(&time);
+    return ticks_to((u64)time.QuadPart, 1000000);
+}
+
+u64 pf_get_cpu_time_us()
+{
+    // Kernel plus user time in 100ns units
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+    u64 k = ((u64)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime;
+    u64 u = ((u64)user.dwHighDateTime << 32) | user.dwLowDateTime;
+    return (k + u) / 10;
+}
+
+void pf_sleep_until(u64 deadline_us)
+{
+    u64 now = pf_get_time_us();
+    if (now >= deadline_us) return;
+
+    if (os_state.timer != NULL)
+    {
+        // Negative due times are relative, in 100ns units
+        LARGE_INTEGER due;
+        due.QuadPart = -(LONGLONG)((deadline_us - now) * 10);
+        if (SetWaitableTimer(os_state.timer, &due, 0, NULL, NULL, FALSE))
+        {
+            WaitForSingleObject(os_state.timer, INFINITE);
+            return;
+        }
+    }
+
+    Sleep((DWORD)((deadline_us - now + 999) / 1000));
+}
+
+u8 pf_mkdir(const char *path)
+{
+    if (_mkdir(path) == 0) return 1;
+    return 0;
+}
+
+u8 pf_write_file(const char *path, const u8 *data, u32 size)
+{
+    char temporary[PF_MAX_PATH + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+    FILE *file = fopen(temporary, "wb");
+    if (file == NULL)
+    {
+        printf("Failed to open %s\n", temporary);
+        return 0;
+    }
+    u8 written = fwrite(data, 1, size, file) == size;
+    if (fclose(file) != 0) written = 0;
+    if (!written)
+    {
+        printf("Failed to write %s\n", temporary);
+        remove(temporary);
+        return 0;
+    }
+
+    // Unlike rename, MoveFileEx can replace a file that exists
+    if (!MoveFileExA(temporary, path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        printf("Failed to replace %s, error %lu\n", path, (unsigned long)GetLastError());
+        remove(temporary);
+        return 0;
+    }
+    return 1;
+}
+
+static struct sockaddr_in loopback(u16 port)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return address;
+}
+
+u8 pf_udp_open(u16 local_port, u16 remote_port)
+{
+    pf_udp_close();
+    if (!os_state.winsock)
+    {
+        WSADATA data;
+        if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+        {
+            printf("Failed to start Winsock\n");
+            return 0;
+        }
+        os_state.winsock = 1;
+    }
+
+    os_state.socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (os_state.socket == INVALID_SOCKET)
+    {
+        printf("Failed to create a socket, error %d\n", WSAGetLastError());
+        return 0;
+    }
+
+    // Connecting means send and recv only ever talk to the other process
+    u_long nonblocking = 1;
+    struct sockaddr_in local = loopback(local_port);
+    struct sockaddr_in remote = loopback(remote_port);
+    if (ioctlsocket(os_state.socket, FIONBIO, &nonblocking) != 0 ||
+        bind(os_state.socket, (struct sockaddr *)&local, sizeof(local)) != 0 ||
+        connect(os_state.socket, (struct sockaddr *)&remote, sizeof(remote)) != 0)
+    {
+        printf("Failed to open UDP port %d, error %d\n", (int)local_port, WSAGetLastError());
+        pf_udp_close();
+        return 0;
+    }
+    return 1;
+}
+
+void pf_udp_close()
+{
+    if (os_state.socket != INVALID_SOCKET) closesocket(os_state.socket);
+    os_state.socket = INVALID_SOCKET;
+}
+
+u8 pf_udp_send(const u8 *data, u32 size)
+{
+    if (os_state.socket == INVALID_SOCKET) return 0;
+    return send(os_state.socket, (const char *)data, (int)size, 0) == (int)size;
+}
+
+u32 pf_udp_receive(u8 *data, u32 capacity)
+{
+    if (os_state.socket == INVALID_SOCKET) return 0;
+    while (1)
+    {
+        int size = recv(os_state.socket, (char *)data, (int)capacity, 0);
+        if (size > 0) return (u32)size;
+        // Reset means an earlier send found nobody listening yet, anything else means nothing is waiting
+        if (size == SOCKET_ERROR && WSAGetLastError() == WSAECONNRESET) continue;
+        return 0;
+    }
+}
+
+u32 pf_cpu_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (u32)info.dwNumberOfProcessors : 1;
+}
+
+struct thread_start
+{
+    void (*work)(u32 index, void *data);
+    void *data;
+    u32 index;
+};
+
+static DWORD WINAPI thread_main(LPVOID start)
+{
+    struct thread_start *thread = start;
+    thread->work(thread->index, thread->data);
+    return 0;
+}
+
+u8 pf_run_threads(u32 count, void (*work)(u32 index, void *data), void *data)
+{
+    if (count == 0 || count > PF_MAX_THREADS) return 0;
+
+    HANDLE threads[PF_MAX_THREADS];
+    struct thread_start starts[PF_MAX_THREADS];
+    u32 started = 1;
+    u8 ok = 1;
+    for (u32 i = 1; i < count; i++)
+    {
+        starts[started].work = work;
+        starts[started].data = data;
+        starts[started].index = i;
+        threads[started] = CreateThread(NULL, 0, thread_main, &starts[started], 0, NULL);
+        if (threads[started] == NULL)
+        {
+            printf("Failed to start thread %" PRIu32 ": error %lu\n", i, (unsigned long)GetLastError());
+            ok = 0;
+            break;
+        }
+        started++;
+    }
+
+    work(0, data);
+    for (u32 i = 1; i < started; i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+    return ok;
+}
+
+void pf_yield()
+{
+    SwitchToThread();
+}
+
+i64 pf_atomic_load(volatile i64 *value)
+{
+    // Swapping 0 for 0 is a full barrier read
+    return InterlockedCompareExchange64((volatile LONG64 *)value, 0, 0);
+}
+
+void pf_atomic_store(volatile i64 *value, i64 desired)
+{
+    InterlockedExchange64((volatile LONG64 *)value, desired);
+}
+
+u8 pf_atomic_cas(volatile i64 *value, i64 expected, i64 desired)
+{
+    return InterlockedCompareExchange64((volatile LONG64 *)value, desired, expected) == expected;
+}
+
+i64 pf_atomic_add(volatile i64 *value, i64 amount)
+{
+    return InterlockedExchangeAdd64((volatile LONG64 *)value, amount) + amount;
+}
\ No newline at end of file
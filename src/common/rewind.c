@@ -0,0 +1,275 @@
+#include "rewind.h"
+
+#include "chip8.h"
+#include "platform.h"
+#include "snapshot.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ENCODED_MAX (SNAPSHOT_PAYLOAD_SIZE + (SNAPSHOT_PAYLOAD_SIZE + 127) / 128) // rle_max_size of a payload
+#define MIN_FRAME_BYTES 80 // A delta with nothing changed is still a run for every 129 bytes
+
+struct rewind_frame
+{
+    u32 offset; // Into the arena
+    u32 size;
+    u8 keyframe;
+};
+
+struct rewind_state
+{
+    u8 *arena;
+    u32 budget;
+    u32 write; // Where the bytes of the newest frame end
+
+    struct rewind_frame *frames; // Ring indexed by sequence number
+    u32 max_frames;
+    u64 first; // Sequence number of the oldest frame
+    u32 count;
+    u64 live_bytes;
+
+    u8 key[SNAPSHOT_PAYLOAD_SIZE]; // Decoded payload of frame key_sequence
+    u64 key_sequence;
+    u8 key_valid; // Whether key holds the newest keyframe in the ring
+
+    u8 payload[SNAPSHOT_PAYLOAD_SIZE];
+    u8 delta[SNAPSHOT_PAYLOAD_SIZE];
+    u8 encoded[ENCODED_MAX];
+
+    // Stats
+    u64 captured;
+    u64 keyframes;
+    u64 bytes;
+    u64 key_bytes;
+    u32 max_bytes;
+    u64 dropped; // Frames forgotten to make room
+    u32 peak_frames;
+    u64 peak_bytes;
+    u64 capture_ns;
+    u64 capture_max_ns;
+    u64 restored;
+    u64 restore_ns;
+    u64 restore_max_ns;
+};
+
+static struct rewind_state ring;
+
+u8 rewind_init(u32 budget)
+{
+    rewind_free();
+    if (budget < REWIND_MIN_BUDGET)
+    {
+        printf("Rewind buffer should be at least %d KB\n", REWIND_MIN_BUDGET / 1024);
+        return 0;
+    }
+
+    ring.budget = budget;
+    ring.max_frames = budget / MIN_FRAME_BYTES + 1;
+    ring.arena = malloc(budget);
+    ring.frames = malloc(sizeof(struct rewind_frame) * ring.max_frames);
+    if (ring.arena == NULL || ring.frames == NULL)
+    {
+        printf("Failed to allocate %" PRIu32 " KB for the rewind buffer\n", budget / 1024);
+        rewind_free();
+        return 0;
+    }
+
+    // Touching every page now keeps page faults out of the first pass around the ring
+    memset(ring.arena, 0, budget);
+    return 1;
+}
+
+void rewind_free()
+{
+    free(ring.arena);
+    free(ring.frames);
+    memset(&ring, 0, sizeof(ring));
+}
+
+u32 rewind_frames()
+{
+    return ring.count;
+}
+
+static struct rewind_frame *frame_at(u64 sequence)
+{
+    return &ring.frames[sequence % ring.max_frames];
+}
+
+// Drops the oldest keyframe and every delta against it
+static void drop_oldest_group()
+{
+    do
+    {
+        ring.live_bytes -= frame_at(ring.first)->size;
+        ring.first++;
+        ring.count--;
+        ring.dropped++;
+    } while (ring.count > 0 && !frame_at(ring.first)->keyframe);
+
+    if (ring.count == 0) ring.write = 0;
+}
+
+// Drops old frames until size bytes fit in one piece, returns the offset they go at
+static u32 make_room(u32 size)
+{
+    while (1)
+    {
+        if (ring.count == ring.max_frames)
+        {
+            drop_oldest_group();
+            continue;
+        }
+        if (ring.count == 0) return 0;
+
+        // Live bytes run from the oldest frame to write, wrapping around the end of the arena
+        u32 start = frame_at(ring.first)->offset;
+        if (ring.write > start)
+        {
+            if (ring.budget - ring.write >= size) return ring.write;
+            if (start >= size) return 0;
+        }
+        else if (start - ring.write >= size)
+        {
+            return ring.write;
+        }
+        drop_oldest_group();
+    }
+}
+
+static u32 encode(u8 keyframe)
+{
+    if (keyframe) return rle_encode(ring.payload, SNAPSHOT_PAYLOAD_SIZE, ring.encoded, ENCODED_MAX);
+
+    for (u32 i = 0; i < SNAPSHOT_PAYLOAD_SIZE; i++)
+    {
+        ring.delta[i] = ring.payload[i] ^ ring.key[i];
+    }
+    return rle_encode(ring.delta, SNAPSHOT_PAYLOAD_SIZE, ring.encoded, ENCODED_MAX);
+}
+
+void rewind_capture(struct chip8 *state)
+{
+    if (ring.arena == NULL) return;
+    u64 start_ns = pf_get_time_ns();
+
+    write_snapshot_payload(state, ring.payload);
+    u64 sequence = ring.first + ring.count;
+    u8 keyframe = !ring.key_valid || sequence - ring.key_sequence >= REWIND_KEYFRAME_INTERVAL;
+    u32 size = encode(keyframe);
+    u32 offset = make_room(size);
+    if (!keyframe && (ring.count == 0 || ring.first > ring.key_sequence))
+    {
+        // Making room dropped the keyframe this delta is against
+        keyframe = 1;
+        size = encode(1);
+        offset = make_room(size);
+    }
+
+    memcpy(&ring.arena[offset], ring.encoded, size);
+    struct rewind_frame *frame = frame_at(sequence);
+    frame->offset = offset;
+    frame->size = size;
+    frame->keyframe = keyframe;
+    ring.count++;
+    ring.write = offset + size;
+    ring.live_bytes += size;
+    if (ring.count > ring.peak_frames) ring.peak_frames = ring.count;
+    if (ring.live_bytes > ring.peak_bytes) ring.peak_bytes = ring.live_bytes;
+
+    if (keyframe)
+    {
+        memcpy(ring.key, ring.payload, SNAPSHOT_PAYLOAD_SIZE);
+        ring.key_sequence = sequence;
+        ring.key_valid = 1;
+        ring.keyframes++;
+        ring.key_bytes += size;
+    }
+
+    ring.captured++;
+    ring.bytes += size;
+    if (size > ring.max_bytes) ring.max_bytes = size;
+    u64 ns = pf_get_time_ns() - start_ns;
+    ring.capture_ns += ns;
+    if (ns > ring.capture_max_ns) ring.capture_max_ns = ns;
+}
+
+u8 rewind_step(struct chip8 *state)
+{
+    if (ring.arena == NULL || ring.count == 0) return 0;
+    u64 start_ns = pf_get_time_ns();
+
+    // The ring always starts on a keyframe so this stops inside it
+    u64 sequence = ring.first + ring.count - 1;
+    u64 key_sequence = sequence;
+    while (!frame_at(key_sequence)->keyframe) key_sequence--;
+
+    if (!ring.key_valid || ring.key_sequence != key_sequence)
+    {
+        struct rewind_frame *key = frame_at(key_sequence);
+        rle_decode(&ring.arena[key->offset], key->size, ring.key, SNAPSHOT_PAYLOAD_SIZE);
+        ring.key_sequence = key_sequence;
+        ring.key_valid = 1;
+    }
+
+    struct rewind_frame *frame = frame_at(sequence);
+    if (frame->keyframe)
+    {
+        memcpy(ring.payload, ring.key, SNAPSHOT_PAYLOAD_SIZE);
+        ring.key_valid = 0; // Forgotten below, the next capture starts a new keyframe
+    }
+    else
+    {
+        rle_decode(&ring.arena[frame->offset], frame->size, ring.delta, SNAPSHOT_PAYLOAD_SIZE);
+        for (u32 i = 0; i < SNAPSHOT_PAYLOAD_SIZE; i++)
+        {
+            ring.payload[i] = ring.delta[i] ^ ring.key[i];
+        }
+    }
+    read_snapshot_payload(state, ring.payload);
+
+    ring.count--;
+    ring.live_bytes -= frame->size;
+    if (ring.count == 0)
+    {
+        ring.write = 0;
+    }
+    else
+    {
+        struct rewind_frame *newest = frame_at(sequence - 1);
+        ring.write = newest->offset + newest->size;
+    }
+
+    ring.restored++;
+    u64 ns = pf_get_time_ns() - start_ns;
+    ring.restore_ns += ns;
+    if (ns > ring.restore_max_ns) ring.restore_max_ns = ns;
+    return 1;
+}
+
+void print_rewind_report()
+{
+    if (ring.arena == NULL) return;
+
+    printf("Rewind: held up to %" PRIu32 " frames (%.1f s) in %" PRIu64 " of %" PRIu32 " KB, %" PRIu64 " dropped to make room\n",
+        ring.peak_frames, (f64)ring.peak_frames / FRAME_RATE, ring.peak_bytes / 1024, ring.budget / 1024, ring.dropped);
+    if (ring.captured == 0) return;
+
+    u64 deltas = ring.captured - ring.keyframes;
+    printf("  Bytes per frame: mean %" PRIu64 ", keyframes %" PRIu64 ", deltas %" PRIu64 ", max %" PRIu32 " (%d raw)\n",
+        ring.bytes / ring.captured, ring.keyframes ? ring.key_bytes / ring.keyframes : 0,
+        deltas ? (ring.bytes - ring.key_bytes) / deltas : 0, ring.max_bytes, SNAPSHOT_PAYLOAD_SIZE);
+
+    f64 frame_ns = 1000000000.0 / FRAME_RATE;
+    f64 capture_mean = (f64)ring.capture_ns / ring.captured;
+    printf("  Capture: %" PRIu64 " frames, mean %.1f us, max %.1f us (%.3f%% of a frame on average)\n",
+        ring.captured, capture_mean / 1000.0, ring.capture_max_ns / 1000.0, 100.0 * capture_mean / frame_ns);
+    if (ring.restored > 0)
+    {
+        printf("  Restore: %" PRIu64 " frames, mean %.1f us, max %.1f us\n",
+            ring.restored, (f64)ring.restore_ns / ring.restored / 1000.0, ring.restore_max_ns / 1000.0);
+    }
+}
\ No newline at end of file
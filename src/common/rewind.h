@@ -0,0 +1,34 @@
+#ifndef _REWIND_H_
+#define _REWIND_H_
+
+#include "types.h"
+
+/*
+Rewind buffer
+
+The state at the start of every frame goes into a ring held in a fixed budget of memory.
+Every REWIND_KEYFRAME_INTERVAL frames the snapshot payload is stored whole, run length
+encoded, and the frames between store the payload XORed with that keyframe's, run length
+encoded. Nearly everything is the same from one frame to the next so most of a delta is
+runs of zero, a frame usually costs a few hundred bytes
+
+Restoring a frame decodes at most its keyframe and itself, the decoded keyframe is kept so
+stepping back through a group only decodes each delta
+
+When the budget is full the oldest keyframe goes along with every delta that needs it, so
+the ring always starts on a keyframe
+*/
+
+#define REWIND_KEYFRAME_INTERVAL 60
+#define REWIND_MIN_BUDGET (64 * 1024)
+
+struct chip8;
+
+u8 rewind_init(u32 budget); // Budget in bytes, at least REWIND_MIN_BUDGET, returns 0 if it couldn't be allocated
+void rewind_free();
+void rewind_capture(struct chip8 *state); // Call at the start of every frame
+u8 rewind_step(struct chip8 *state); // Goes back to the newest frame captured and forgets it, returns 0 if there's nothing left
+u32 rewind_frames(); // Frames that can be stepped back through
+void print_rewind_report();
+
+#endif //_REWIND_H_
\ No newline at end of file
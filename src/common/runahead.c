@@ -0,0 +1,60 @@
+#include "runahead.h"
+
+#include "chip8.h"
+#include "platform.h"
+#include "timer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void init_runahead(struct runahead *ahead, u32 frames)
+{
+    memset(ahead, 0, sizeof(*ahead));
+    ahead->frames = frames;
+}
+
+u8 run_ahead(struct runahead *ahead, struct chip8 *state, enum engine engine, struct frame_scheduler *scheduler)
+{
+    ahead->started_ns = pf_get_time_ns();
+    write_snapshot_payload(state, ahead->payload);
+    ahead->save_ns += pf_get_time_ns() - ahead->started_ns;
+
+    // The budgets the real frames will get, without using them up
+    struct frame_scheduler budgets = *scheduler;
+    u16 keys = state->keys;
+    for (u32 frame = 0; frame < ahead->frames && !state->halt; frame++)
+    {
+        set_frame_keys(state, keys, 0);
+        run_engine(state, engine, scheduler_budget(&budgets));
+        tick_timers(state);
+    }
+
+    u8 changed = memcmp(ahead->shown, state->screen, sizeof(ahead->shown)) != 0;
+    memcpy(ahead->shown, state->screen, sizeof(ahead->shown));
+    return changed;
+}
+
+void end_run_ahead(struct runahead *ahead, struct chip8 *state)
+{
+    u64 start_ns = pf_get_time_ns();
+    read_snapshot_payload(state, ahead->payload);
+    u64 end_ns = pf_get_time_ns();
+
+    u64 ns = end_ns - ahead->started_ns;
+    ahead->runs++;
+    ahead->restore_ns += end_ns - start_ns;
+    ahead->total_ns += ns;
+    if (ns > ahead->max_ns) ahead->max_ns = ns;
+}
+
+void print_runahead_report(struct runahead *ahead)
+{
+    if (ahead->runs == 0) return;
+
+    f64 frame_ns = 1000000000.0 / FRAME_RATE;
+    f64 mean = (f64)ahead->total_ns / ahead->runs;
+    printf("Run-ahead: %" PRIu32 " frames, ran ahead %" PRIu64 " times, mean %.1f us, max %.1f us (%.2f%% of a frame on average)\n",
+        ahead->frames, ahead->runs, mean / 1000.0, ahead->max_ns / 1000.0, 100.0 * mean / frame_ns);
+    printf("  Save: mean %.2f us, restore: mean %.2f us\n",
+        (f64)ahead->save_ns / ahead->runs / 1000.0, (f64)ahead->restore_ns / ahead->runs / 1000.0);
+}
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef _RUNAHEAD_H_
+#define _RUNAHEAD_H_
+
+#include "types.h"
+#include "engine.h"
+#include "chip8.h"
+#include "snapshot.h"
+
+/*
+Run-ahead
+
+Most games only react to a key a frame or more after they read it, they poll the keypad
+with Ex9E/ExA1 and move things on their own schedule. Run-ahead hides that lag: after the
+real frame the state is saved, the machine runs a few frames further with the keys that
+frame saw, that screen is what gets shown, and the saved state goes back. The screen is
+always frames ahead of the machine, which is exactly right as long as the keys don't
+change and is corrected by the next real frame when they do
+
+Saving and restoring are write_snapshot_payload and read_snapshot_payload, a few
+microseconds each. Decoded instructions survive the restore unless the frames ahead wrote
+to memory. Frames ahead never queue sound, capture rewind or touch a recording
+
+Each struct runahead is for one machine
+*/
+
+#define RUNAHEAD_MAX_FRAMES 8
+
+struct chip8;
+struct frame_scheduler;
+
+struct runahead
+{
+    u32 frames; // How far ahead to run, 0 is off
+    u8 payload[SNAPSHOT_PAYLOAD_SIZE]; // The real frame while the machine is ahead
+    u64 shown[DISPLAY_HEIGHT]; // Screen from the last time it ran ahead
+    u64 started_ns; // When the machine was saved
+
+    // Stats
+    u64 runs;
+    u64 save_ns;
+    u64 restore_ns;
+    u64 total_ns;
+    u64 max_ns;
+};
+
+void init_runahead(struct runahead *ahead, u32 frames);
+u8 run_ahead(struct runahead *ahead, struct chip8 *state, enum engine engine, struct frame_scheduler *scheduler); // Runs ahead with the keys the last frame saw, returns 1 if the screen differs from the last run
+void end_run_ahead(struct runahead *ahead, struct chip8 *state); // Puts the real frame back
+void print_runahead_report(struct runahead *ahead);
+
+#endif //_RUNAHEAD_H_
\ No newline at end of file
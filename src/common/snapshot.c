@@ -0,0 +1,335 @@
+#include "snapshot.h"
+
+#include "chip8.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const u8 snapshot_magic[8] = { 'C', '8', 'S', 'T', 'A', 'T', 'E', 0 };
+
+static u8 file_buffer[SNAPSHOT_MAX_SIZE];
+
+static u8 *put_u16(u8 *out, u16 value)
+{
+    out[0] = (u8)value;
+    out[1] = (u8)(value >> 8);
+    return out + 2;
+}
+
+static u8 *put_u32(u8 *out, u32 value)
+{
+    out = put_u16(out, (u16)value);
+    return put_u16(out, (u16)(value >> 16));
+}
+
+static u8 *put_u64(u8 *out, u64 value)
+{
+    out = put_u32(out, (u32)value);
+    return put_u32(out, (u32)(value >> 32));
+}
+
+static u8 *put_bytes(u8 *out, const u8 *data, u32 size)
+{
+    memcpy(out, data, size);
+    return out + size;
+}
+
+static u16 get_u16(const u8 **in)
+{
+    const u8 *bytes = *in;
+    *in += 2;
+    return (u16)(bytes[0] | (bytes[1] << 8));
+}
+
+static u32 get_u32(const u8 **in)
+{
+    u32 low = get_u16(in);
+    return low | ((u32)get_u16(in) << 16);
+}
+
+static u64 get_u64(const u8 **in)
+{
+    u64 low = get_u32(in);
+    return low | ((u64)get_u32(in) << 32);
+}
+
+static void get_bytes(const u8 **in, u8 *data, u32 size)
+{
+    memcpy(data, *in, size);
+    *in += size;
+}
+
+u64 snapshot_checksum(const u8 *data, u32 size)
+{
+    // FNV-1a, the same hash hash_screen uses
+    u64 hash = 0xcbf29ce484222325;
+    for (u32 i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+u32 rle_max_size(u32 size)
+{
+    // Worst case is all literals, one control byte per 128
+    return size + (size + 127) / 128;
+}
+
+u32 rle_encode(const u8 *data, u32 size, u8 *out, u32 capacity)
+{
+    u32 in = 0;
+    u32 used = 0;
+    while (in < size)
+    {
+        u32 run = 1;
+        while (in + run < size && run < 129 && data[in + run] == data[in]) run++;
+
+        if (run >= 3)
+        {
+            if (used + 2 > capacity) return 0;
+            out[used++] = (u8)(126 + run);
+            out[used++] = data[in];
+            in += run;
+            continue;
+        }
+
+        // Literals up to the next run worth encoding
+        u32 start = in;
+        while (in < size && in - start < 128)
+        {
+            if (in + 2 < size && data[in] == data[in + 1] && data[in] == data[in + 2]) break;
+            in++;
+        }
+        u32 count = in - start;
+        if (used + 1 + count > capacity) return 0;
+        out[used++] = (u8)(count - 1);
+        memcpy(&out[used], &data[start], count);
+        used += count;
+    }
+    return used;
+}
+
+u32 rle_decode(const u8 *data, u32 size, u8 *out, u32 capacity)
+{
+    u32 in = 0;
+    u32 used = 0;
+    while (in < size)
+    {
+        u8 control = data[in++];
+        if (control < 128)
+        {
+            u32 count = control + 1;
+            if (in + count > size || used + count > capacity) return 0;
+            memcpy(&out[used], &data[in], count);
+            in += count;
+            used += count;
+        }
+        else
+        {
+            u32 count = control - 126;
+            if (in >= size || used + count > capacity) return 0;
+            memset(&out[used], data[in++], count);
+            used += count;
+        }
+    }
+    return used;
+}
+
+void write_snapshot_payload(struct chip8 *state, u8 *out)
+{
+    out = put_u16(out, state->cpu.pc);
+    out = put_u16(out, state->cpu.i);
+    *out++ = state->cpu.delay;
+    *out++ = state->cpu.sound;
+    out = put_bytes(out, state->cpu.v, 16);
+
+    out = put_bytes(out, state->memory, MEMORY_SIZE);
+    for (int j = 0; j < DISPLAY_HEIGHT; j++)
+    {
+        out = put_u64(out, state->screen[j]);
+    }
+
+    out = put_bytes(out, state->stack, STACK_SIZE);
+    out = put_u16(out, (u16)(state->sp - state->stack));
+
+    out = put_u64(out, state->cycles);
+    *out++ = state->halt;
+    *out++ = state->await_input;
+    *out++ = state->input_register;
+    out = put_u16(out, state->keys);
+    put_u64(out, state->random);
+}
+
+u8 read_snapshot_payload(struct chip8 *state, const u8 *payload)
+{
+    // Values that would put the machine outside its memory are refused before anything changes
+    const u8 *in = payload;
+    u16 pc = get_u16(&in);
+    in += 20 + MEMORY_SIZE + 8 * DISPLAY_HEIGHT + STACK_SIZE;
+    u16 sp = get_u16(&in);
+    in += 10;
+    u8 input_register = *in;
+    if (pc >= MEMORY_SIZE || sp > STACK_SIZE || input_register > 0xF)
+    {
+        printf("Snapshot has an impossible pc, stack pointer or input register\n");
+        return 0;
+    }
+
+    in = payload;
+    state->cpu.pc = get_u16(&in);
+    state->cpu.i = get_u16(&in);
+    state->cpu.delay = *in++;
+    state->cpu.sound = *in++;
+    get_bytes(&in, state->cpu.v, 16);
+
+    // Decoded instructions stay valid if memory is the same, which it usually is between nearby frames
+    u8 memory_changed = memcmp(state->memory, in, MEMORY_SIZE) != 0;
+    get_bytes(&in, state->memory, MEMORY_SIZE);
+    for (int j = 0; j < DISPLAY_HEIGHT; j++)
+    {
+        state->screen[j] = get_u64(&in);
+    }
+    state->screen_dirty = 1;
+
+    get_bytes(&in, state->stack, STACK_SIZE);
+    state->sp = state->stack + get_u16(&in);
+
+    state->cycles = get_u64(&in);
+    state->halt = *in++;
+    state->await_input = *in++;
+    state->input_register = *in++;
+    state->keys = get_u16(&in);
+    state->random = get_u64(&in);
+
+    if (memory_changed)
+    {
+        memset(state->decoded_valid, 0, MEMORY_SIZE);
+        state->code_modified = 1; // Anything an engine has cached belongs to the memory that was just replaced
+    }
+    return 1;
+}
+
+u32 save_snapshot(struct chip8 *state, u8 *buffer, u32 capacity, u16 flags)
+{
+    if (capacity < SNAPSHOT_HEADER_SIZE) return 0;
+
+    u8 payload[SNAPSHOT_PAYLOAD_SIZE];
+    write_snapshot_payload(state, payload);
+
+    u32 size = 0;
+    if (flags & SNAPSHOT_COMPRESSED)
+    {
+        size = rle_encode(payload, SNAPSHOT_PAYLOAD_SIZE, &buffer[SNAPSHOT_HEADER_SIZE], capacity - SNAPSHOT_HEADER_SIZE);
+        if (size == 0 || size >= SNAPSHOT_PAYLOAD_SIZE) flags &= ~SNAPSHOT_COMPRESSED; // Stored as it is if that's smaller
+    }
+    if (!(flags & SNAPSHOT_COMPRESSED))
+    {
+        if (capacity - SNAPSHOT_HEADER_SIZE < SNAPSHOT_PAYLOAD_SIZE) return 0;
+        size = SNAPSHOT_PAYLOAD_SIZE;
+        memcpy(&buffer[SNAPSHOT_HEADER_SIZE], payload, SNAPSHOT_PAYLOAD_SIZE);
+    }
+
+    u8 *out = put_bytes(buffer, snapshot_magic, sizeof(snapshot_magic));
+    out = put_u16(out, SNAPSHOT_VERSION);
+    out = put_u16(out, flags);
+    out = put_u32(out, size);
+    out = put_u32(out, SNAPSHOT_PAYLOAD_SIZE);
+    out = put_u32(out, 0);
+    put_u64(out, snapshot_checksum(payload, SNAPSHOT_PAYLOAD_SIZE));
+
+    return SNAPSHOT_HEADER_SIZE + size;
+}
+
+u8 load_snapshot(struct chip8 *state, const u8 *buffer, u32 size)
+{
+    if (size < SNAPSHOT_HEADER_SIZE || memcmp(buffer, snapshot_magic, sizeof(snapshot_magic)) != 0)
+    {
+        printf("Not a chip-8 snapshot\n");
+        return 0;
+    }
+
+    const u8 *in = buffer + sizeof(snapshot_magic);
+    u16 version = get_u16(&in);
+    u16 flags = get_u16(&in);
+    u32 stored_size = get_u32(&in);
+    u32 raw_size = get_u32(&in);
+    get_u32(&in); // Reserved
+    u64 sum = get_u64(&in);
+
+    if (version == 0 || version > SNAPSHOT_VERSION || (flags & ~SNAPSHOT_COMPRESSED))
+    {
+        printf("Snapshot is version %d, this build reads up to version %d\n", (int)version, SNAPSHOT_VERSION);
+        return 0;
+    }
+    u32 payload_size = version == 1 ? SNAPSHOT_PAYLOAD_SIZE_V1 : SNAPSHOT_PAYLOAD_SIZE;
+    if (raw_size != payload_size || stored_size > size - SNAPSHOT_HEADER_SIZE)
+    {
+        printf("Snapshot is truncated\n");
+        return 0;
+    }
+
+    u8 payload[SNAPSHOT_PAYLOAD_SIZE];
+    const u8 *stored = buffer + SNAPSHOT_HEADER_SIZE;
+    if (flags & SNAPSHOT_COMPRESSED)
+    {
+        if (rle_decode(stored, stored_size, payload, payload_size) != payload_size)
+        {
+            printf("Snapshot is damaged\n");
+            return 0;
+        }
+    }
+    else
+    {
+        if (stored_size != payload_size)
+        {
+            printf("Snapshot is truncated\n");
+            return 0;
+        }
+        memcpy(payload, stored, payload_size);
+    }
+
+    if (snapshot_checksum(payload, payload_size) != sum)
+    {
+        printf("Snapshot checksum doesn't match, it's damaged\n");
+        return 0;
+    }
+
+    // Version 1 didn't have the generator, the machine keeps its own
+    if (version == 1) put_u64(&payload[SNAPSHOT_PAYLOAD_SIZE_V1], state->random);
+
+    return read_snapshot_payload(state, payload);
+}
+
+u8 save_snapshot_file(struct chip8 *state, const char *path, u16 flags)
+{
+    u32 size = save_snapshot(state, file_buffer, sizeof(file_buffer), flags);
+    return pf_write_file(path, file_buffer, size);
+}
+
+u8 load_snapshot_file(struct chip8 *state, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("Failed to open snapshot: %s\n", path);
+        return 0;
+    }
+
+    u32 size = (u32)fread(file_buffer, 1, sizeof(file_buffer), file);
+    fclose(file);
+
+    if (!load_snapshot(state, file_buffer, size))
+    {
+        printf("Failed to load snapshot: %s\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+void snapshot_slot_path(int slot, char *path, int size)
+{
+    snprintf(path, size, "states/slot%d.c8s", slot);
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "types.h"
+#include "chip8.h"
+
+/*
+Save states
+
+A snapshot is a fixed header followed by the machine state, every number little endian
+and the stack pointer stored as an offset into the stack, so a snapshot loads on any host
+whatever its pointer size or byte order
+
+Header (SNAPSHOT_HEADER_SIZE bytes)
+    magic     8 bytes "C8STATE\0"
+    version   u16, loaders refuse anything newer than SNAPSHOT_VERSION
+    flags     u16, SNAPSHOT_COMPRESSED
+    size      u32, bytes of payload following the header as stored
+    raw size  u32, bytes of payload once decompressed
+    reserved  u32, 0
+    checksum  u64, FNV-1a of the decompressed payload
+
+Payload (version 2, SNAPSHOT_PAYLOAD_SIZE bytes)
+    pc u16, i u16, delay u8, sound u8, v[16]
+    memory[MEMORY_SIZE]
+    screen, DISPLAY_HEIGHT u64 rows
+    stack[STACK_SIZE], sp u16 offset
+    cycles u64, halt u8, await_input u8, input_register u8, keys u16
+    random u64
+
+Version 1 is the same without random, loading one keeps the generator the machine has
+
+Compressed payloads use byte oriented run length encoding, a control byte below 128 is
+followed by that many plus one literal bytes, 128 and up repeats the next byte control - 126
+times. Memory and the screen are mostly zeros so a compressed snapshot is usually well
+under half the size
+
+Loading checks everything before touching the machine, a damaged or truncated snapshot
+leaves it exactly as it was
+*/
+
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_HEADER_SIZE 32
+#define SNAPSHOT_PAYLOAD_SIZE_V1 (22 + MEMORY_SIZE + 8 * DISPLAY_HEIGHT + STACK_SIZE + 2 + 13)
+#define SNAPSHOT_PAYLOAD_SIZE (SNAPSHOT_PAYLOAD_SIZE_V1 + 8)
+#define SNAPSHOT_MAX_SIZE (SNAPSHOT_HEADER_SIZE + SNAPSHOT_PAYLOAD_SIZE + (SNAPSHOT_PAYLOAD_SIZE + 127) / 128)
+#define SNAPSHOT_COMPRESSED 0x1
+#define SNAPSHOT_SLOTS 10
+
+u32 save_snapshot(struct chip8 *state, u8 *buffer, u32 capacity, u16 flags); // Returns bytes written, 0 if they don't fit in capacity (SNAPSHOT_MAX_SIZE always does)
+u8 load_snapshot(struct chip8 *state, const u8 *buffer, u32 size); // Returns 0 if the snapshot is damaged or too new
+
+u8 save_snapshot_file(struct chip8 *state, const char *path, u16 flags); // Returns 0 on failure
+u8 load_snapshot_file(struct chip8 *state, const char *path); // Returns 0 on failure
+void snapshot_slot_path(int slot, char *path, int size); // states/slot<slot>.c8s
+
+// The payload on its own, SNAPSHOT_PAYLOAD_SIZE bytes with no header or checksum
+void write_snapshot_payload(struct chip8 *state, u8 *payload);
+u8 read_snapshot_payload(struct chip8 *state, const u8 *payload); // Returns 0 and leaves state alone if the payload is impossible
+u64 snapshot_checksum(const u8 *data, u32 size); // FNV-1a, what the header stores for the payload
+
+// Run length encoding shared with anything else that stores state
+u32 rle_encode(const u8 *data, u32 size, u8 *out, u32 capacity); // Returns bytes written, 0 if they don't fit
+u32 rle_decode(const u8 *data, u32 size, u8 *out, u32 capacity); // Returns bytes written, 0 if the data is damaged or doesn't fit
+u32 rle_max_size(u32 size); // Largest rle_encode output for size bytes
+
+#endif //_SNAPSHOT_H_
\ No newline at end of file
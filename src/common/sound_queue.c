@@ -0,0 +1,43 @@
+#include "sound_queue.h"
+
+#include <string.h>
+
+void sq_init(struct sound_queue *sq)
+{
+    memset(sq->frames, 0, sizeof(sq->frames));
+    SDL_AtomicSet(&sq->head, 0);
+    SDL_AtomicSet(&sq->tail, 0);
+}
+
+u32 sq_count(struct sound_queue *sq)
+{
+    // Counters run freely and wrap, the difference is still right
+    return (u32)SDL_AtomicGet(&sq->head) - (u32)SDL_AtomicGet(&sq->tail);
+}
+
+u8 sq_push(struct sound_queue *sq, u8 on)
+{
+    u32 head = (u32)SDL_AtomicGet(&sq->head);
+    if (head - (u32)SDL_AtomicGet(&sq->tail) >= SOUND_QUEUE_SIZE) return 0;
+
+    sq->frames[head & (SOUND_QUEUE_SIZE - 1)] = on;
+
+    // The frame has to be written before the consumer can see it
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&sq->head, (int)(head + 1));
+    return 1;
+}
+
+u8 sq_pop(struct sound_queue *sq, u8 *on)
+{
+    u32 tail = (u32)SDL_AtomicGet(&sq->tail);
+    if ((u32)SDL_AtomicGet(&sq->head) == tail) return 0;
+
+    SDL_MemoryBarrierAcquire();
+    *on = sq->frames[tail & (SOUND_QUEUE_SIZE - 1)];
+
+    // The frame has to be read before the producer can reuse its slot
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&sq->tail, (int)(tail + 1));
+    return 1;
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef _SOUND_QUEUE_H_
+#define _SOUND_QUEUE_H_
+
+#include "types.h"
+
+#include <SDL_atomic.h>
+
+/*
+Lock free single producer, single consumer queue of per frame sound states, handing them
+from the emulator to the audio callback
+
+Each side only ever writes its own counter, the producer publishes a frame by moving head
+past it and the consumer frees one by moving tail past it. Neither side waits, a full
+queue refuses the push and an empty one refuses the pop
+*/
+
+#define SOUND_QUEUE_SIZE 64 // Power of 2
+
+struct sound_queue
+{
+    u8 frames[SOUND_QUEUE_SIZE]; // Whether the tone plays during each frame
+    SDL_atomic_t head; // Frames pushed, only written by the producer
+    SDL_atomic_t tail; // Frames popped, only written by the consumer
+};
+
+void sq_init(struct sound_queue *sq);
+u32 sq_count(struct sound_queue *sq); // Frames waiting, exact for the consumer and an upper bound for the producer
+
+// Producer
+u8 sq_push(struct sound_queue *sq, u8 on); // Returns 0 if the queue is full
+
+// Consumer
+u8 sq_pop(struct sound_queue *sq, u8 *on); // Returns 0 if the queue is empty
+
+#endif //_SOUND_QUEUE_H_
\ No newline at end of file
@@ -0,0 +1,213 @@
+#include "terminal.h"
+
+#include "chip8.h"
+#include "platform.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <io.h> // _write
+#define write _write
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#define TERMINAL_MAX_COLUMNS DISPLAY_WIDTH
+#define TERMINAL_MAX_ROWS (DISPLAY_HEIGHT / 2)
+#define TERMINAL_BUFFER_SIZE 32768
+
+struct terminal_state
+{
+    enum terminal_mode mode;
+    int columns;
+    int rows;
+    u8 shown_valid; // Whether shown matches what's on the terminal
+    u8 shown[TERMINAL_MAX_ROWS][TERMINAL_MAX_COLUMNS]; // Pixel pattern of every cell on the terminal
+    u64 last_frame_us;
+
+    char buffer[TERMINAL_BUFFER_SIZE];
+    int used;
+
+    // Stats
+    u64 frames_sent;
+    u64 frames_dropped;
+    u64 bytes_sent;
+    u64 opened_us;
+};
+
+static struct terminal_state terminal;
+
+u8 parse_terminal_mode(const char *name, enum terminal_mode *mode)
+{
+    if (strcmp(name, "half") == 0)
+    {
+        *mode = TERMINAL_HALF;
+        return 1;
+    }
+    if (strcmp(name, "braille") == 0)
+    {
+        *mode = TERMINAL_BRAILLE;
+        return 1;
+    }
+    return 0;
+}
+
+static void append(const char *text, int length)
+{
+    memcpy(&terminal.buffer[terminal.used], text, length);
+    terminal.used += length;
+}
+
+static void append_utf8(u32 codepoint)
+{
+    // Every cell character is in the 3 byte range
+    char bytes[3];
+    bytes[0] = (char)(0xE0 | (codepoint >> 12));
+    bytes[1] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+    bytes[2] = (char)(0x80 | (codepoint & 0x3F));
+    append(bytes, 3);
+}
+
+static void append_cell(u8 pattern)
+{
+    if (terminal.mode == TERMINAL_HALF)
+    {
+        // Bit 0 is the top pixel, bit 1 the bottom one
+        static const u32 blocks[4] = { ' ', 0x2580, 0x2584, 0x2588 };
+        if (pattern == 0)
+            append(" ", 1);
+        else
+            append_utf8(blocks[pattern]);
+    }
+    else
+    {
+        append_utf8(0x2800 + pattern);
+    }
+}
+
+static u8 pixel(struct chip8 *state, int x, int y)
+{
+    return (state->screen[y] & PIXEL_BIT(x)) != 0;
+}
+
+// Pixels covered by the cell at column, row packed into the bits the cell character uses
+static u8 cell_pattern(struct chip8 *state, int column, int row)
+{
+    if (terminal.mode == TERMINAL_HALF)
+    {
+        return pixel(state, column, 2 * row) | (pixel(state, column, 2 * row + 1) << 1);
+    }
+
+    // Braille dots 1-3 and 4-6 are the top three rows of each column, 7 and 8 the bottom row
+    int x = 2 * column;
+    int y = 4 * row;
+    return pixel(state, x, y)
+        | (pixel(state, x, y + 1) << 1)
+        | (pixel(state, x, y + 2) << 2)
+        | (pixel(state, x + 1, y) << 3)
+        | (pixel(state, x + 1, y + 1) << 4)
+        | (pixel(state, x + 1, y + 2) << 5)
+        | (pixel(state, x, y + 3) << 6)
+        | (pixel(state, x + 1, y + 3) << 7);
+}
+
+// Whether the terminal can take more output without blocking
+static u8 terminal_ready()
+{
+#ifdef _WIN32
+    return 1;
+#else
+    struct pollfd fd = { STDOUT_FILENO, POLLOUT, 0 };
+    return poll(&fd, 1, 0) == 1 && (fd.revents & POLLOUT);
+#endif
+}
+
+static void flush()
+{
+    int offset = 0;
+    while (offset < terminal.used)
+    {
+        int written = (int)write(1, &terminal.buffer[offset], terminal.used - offset);
+        if (written <= 0) break;
+        offset += written;
+    }
+    terminal.bytes_sent += offset;
+    terminal.used = 0;
+}
+
+void terminal_open(enum terminal_mode mode)
+{
+    memset(&terminal, 0, sizeof(terminal));
+    terminal.mode = mode;
+    if (mode == TERMINAL_OFF) return;
+
+    terminal.columns = (mode == TERMINAL_HALF) ? DISPLAY_WIDTH : DISPLAY_WIDTH / 2;
+    terminal.rows = (mode == TERMINAL_HALF) ? DISPLAY_HEIGHT / 2 : DISPLAY_HEIGHT / 4;
+    terminal.opened_us = pf_get_time_us();
+
+    // Anything printed so far goes out before the screen is cleared
+    fflush(stdout);
+    const char *start = "\x1b[?25l\x1b[2J"; // Hide cursor, clear screen
+    append(start, (int)strlen(start));
+    flush();
+}
+
+u8 terminal_present(struct chip8 *state, u8 force)
+{
+    if (terminal.mode == TERMINAL_OFF) return 1;
+
+    u64 now = pf_get_time_us();
+    if (!force && terminal.shown_valid)
+    {
+        if (now - terminal.last_frame_us < 1000000 / TERMINAL_MAX_FPS || !terminal_ready())
+        {
+            terminal.frames_dropped++;
+            return 0;
+        }
+    }
+
+    int cursor_row = -1;
+    int cursor_column = -1;
+    for (int row = 0; row < terminal.rows; row++)
+    {
+        for (int column = 0; column < terminal.columns; column++)
+        {
+            u8 pattern = cell_pattern(state, column, row);
+            if (terminal.shown_valid && terminal.shown[row][column] == pattern) continue;
+
+            if (row != cursor_row || column != cursor_column)
+            {
+                char move[16];
+                int length = snprintf(move, sizeof(move), "\x1b[%d;%dH", row + 1, column + 1);
+                append(move, length);
+            }
+            append_cell(pattern);
+            terminal.shown[row][column] = pattern;
+            cursor_row = row;
+            cursor_column = column + 1;
+        }
+    }
+
+    terminal.shown_valid = 1;
+    terminal.last_frame_us = now;
+    terminal.frames_sent++;
+    flush();
+    return 1;
+}
+
+void terminal_close()
+{
+    if (terminal.mode == TERMINAL_OFF) return;
+
+    char end[32];
+    int length = snprintf(end, sizeof(end), "\x1b[%d;1H\x1b[?25h", terminal.rows + 1); // Below the display, show cursor
+    append(end, length);
+    flush();
+
+    f64 seconds = (pf_get_time_us() - terminal.opened_us) / 1000000.0;
+    if (seconds <= 0.0) seconds = 1e-6;
+    printf("Terminal: sent %" PRIu64 " frames, dropped %" PRIu64 ", %" PRIu64 " bytes (%.1f KB/s)\n",
+        terminal.frames_sent, terminal.frames_dropped, terminal.bytes_sent, terminal.bytes_sent / seconds / 1024.0);
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef _TERMINAL_H_
+#define _TERMINAL_H_
+
+#include "types.h"
+
+/*
+ANSI terminal display for watching headless runs over ssh
+
+Half block cells pack a column of 2 pixels into each character (64x16 characters),
+braille cells pack 2x4 pixels (32x8 characters)
+
+Only cells that changed since the last frame the terminal was sent are written, with a
+cursor move in front of each run of changed cells, and a whole frame goes out in a single
+write. Frames are dropped rather than queued when they come faster than TERMINAL_MAX_FPS
+or the terminal isn't ready for more output, the next frame sent still diffs against
+what the terminal actually shows
+*/
+
+#define TERMINAL_MAX_FPS 30
+
+struct chip8;
+
+enum terminal_mode
+{
+    TERMINAL_OFF,
+    TERMINAL_HALF,
+    TERMINAL_BRAILLE,
+};
+
+u8 parse_terminal_mode(const char *name, enum terminal_mode *mode); // Returns 0 for an unknown mode
+void terminal_open(enum terminal_mode mode);
+u8 terminal_present(struct chip8 *state, u8 force); // Returns whether the frame was sent, force ignores the frame rate and output checks
+void terminal_close(); // Leaves the cursor below the display and prints how much was sent
+
+#endif //_TERMINAL_H_
\ No newline at end of file
@@ -2,22 +2,135 @@
 
 #include "platform.h"
 
-void create_timer_us(struct timer *timer, u64 delay_us)
+#include <stdio.h>
+#include <string.h>
+
+void create_scheduler(struct frame_scheduler *scheduler, u32 tick_rate)
 {
-    timer->_delay_us = delay_us;
-    timer->_last_tick = pf_get_time_us();
+    memset(scheduler, 0, sizeof(*scheduler));
+    scheduler->per_frame = tick_rate / FRAME_RATE;
+    scheduler->remainder = tick_rate % FRAME_RATE;
+    scheduler->speed = SPEED_ONE;
+    scheduler->start_us = pf_get_time_us();
+    init_histogram(&scheduler->frame_time, 1000);
+    init_histogram(&scheduler->jitter, 250);
 }
 
-u8 should_tick(struct timer *timer)
+// Rounded up so frame n is due exactly when n whole frame periods have passed
+static u64 deadline_us(struct frame_scheduler *scheduler, u64 frame)
 {
-    u64 current_time = pf_get_time_us();
-    u64 time_since_last_tick_us = current_time - timer->_last_tick;
+    u64 rate = (u64)FRAME_RATE * scheduler->speed;
+    return scheduler->start_us + (frame * 1000000 * SPEED_ONE + rate - 1) / rate;
+}
+
+u32 scheduler_frames_due(struct frame_scheduler *scheduler)
+{
+    u64 now = pf_get_time_us();
+    u64 next = deadline_us(scheduler, scheduler->frame);
+    if (now < next) return 0;
+
+    histogram_add(&scheduler->jitter, now - next);
+    if (scheduler->last_frame_us != 0) histogram_add(&scheduler->frame_time, now - scheduler->last_frame_us);
+    scheduler->last_frame_us = now;
 
-    if (time_since_last_tick_us > timer->_delay_us)
+    // Frames whose deadline has passed, including the next one
+    u64 due = (now - scheduler->start_us) * FRAME_RATE * scheduler->speed / (1000000 * SPEED_ONE) + 1 - scheduler->frame;
+    u64 catch_up = (u64)SCHEDULER_MAX_CATCH_UP * scheduler->speed / SPEED_ONE;
+    if (catch_up < SCHEDULER_MAX_CATCH_UP) catch_up = SCHEDULER_MAX_CATCH_UP;
+    if (due > catch_up)
     {
-        timer->_last_tick += timer->_delay_us;
-        return 1;
+        // Too far behind, run a few frames to catch up, drop the rest and restart the schedule from now
+        scheduler->frames_dropped += due - catch_up;
+        due = catch_up;
+        scheduler->start_us = now;
+        scheduler->frame = 1;
     }
+    else
+    {
+        scheduler->frame += due;
+    }
+
+    scheduler->frames_run += due;
+    return (u32)due;
+}
+
+u64 scheduler_next_deadline_us(struct frame_scheduler *scheduler)
+{
+    return deadline_us(scheduler, scheduler->frame);
+}
+
+void scheduler_resume(struct frame_scheduler *scheduler)
+{
+    scheduler->start_us = pf_get_time_us();
+    scheduler->frame = 0;
+    scheduler->last_frame_us = 0;
+}
 
-    return 0;
+void scheduler_set_speed(struct frame_scheduler *scheduler, u32 speed)
+{
+    // Frames already handed out keep the old speed, the next one is due a frame at the new speed from now
+    scheduler->speed = speed;
+    scheduler->start_us = pf_get_time_us();
+    scheduler->frame = 1;
+    scheduler->last_frame_us = 0;
+}
+
+u32 scheduler_budget(struct frame_scheduler *scheduler)
+{
+    u32 budget = scheduler->per_frame;
+    scheduler->carry += scheduler->remainder;
+    if (scheduler->carry >= FRAME_RATE)
+    {
+        scheduler->carry -= FRAME_RATE;
+        budget++;
+    }
+    return budget;
+}
+
+void print_scheduler_report(struct frame_scheduler *scheduler)
+{
+    printf("Ran %" PRIu64 " frames, dropped %" PRIu64 " catching up\n", scheduler->frames_run, scheduler->frames_dropped);
+    print_histogram("Frame time", &scheduler->frame_time);
+    print_histogram("Jitter", &scheduler->jitter);
+}
+
+void init_histogram(struct histogram *histogram, u64 bucket_us)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->bucket_us = bucket_us;
+    histogram->min_us = (u64)-1;
+}
+
+void histogram_add(struct histogram *histogram, u64 us)
+{
+    u64 bucket = us / histogram->bucket_us;
+    if (bucket >= HISTOGRAM_BUCKETS) bucket = HISTOGRAM_BUCKETS - 1;
+    histogram->counts[bucket]++;
+    histogram->samples++;
+    histogram->sum_us += us;
+    if (us < histogram->min_us) histogram->min_us = us;
+    if (us > histogram->max_us) histogram->max_us = us;
+}
+
+void print_histogram(const char *name, struct histogram *histogram)
+{
+    if (histogram->samples == 0)
+    {
+        printf("%s: no samples\n", name);
+        return;
+    }
+
+    printf("%s: min %" PRIu64 " us, mean %" PRIu64 " us, max %" PRIu64 " us\n", name,
+        histogram->min_us, histogram->sum_us / histogram->samples, histogram->max_us);
+    for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+    {
+        if (histogram->counts[bucket] == 0) continue;
+
+        u64 low = bucket * histogram->bucket_us;
+        f64 share = 100.0 * histogram->counts[bucket] / histogram->samples;
+        if (bucket == HISTOGRAM_BUCKETS - 1)
+            printf("  %6" PRIu64 "+       us %10" PRIu64 " %5.1f%%\n", low, histogram->counts[bucket], share);
+        else
+            printf("  %6" PRIu64 "-%-6" PRIu64 " us %10" PRIu64 " %5.1f%%\n", low, low + histogram->bucket_us, histogram->counts[bucket], share);
+    }
 }
\ No newline at end of file
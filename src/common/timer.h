@@ -4,22 +4,70 @@
 #include "types.h"
 
 /*
-Currently the timer only works on windows using QPC
-https://docs.microsoft.com/en-us/windows/win32/api/profileapi/nf-profileapi-queryperformancecounter
-SDL timer only has ms precision which is bad :(
+60Hz frame scheduler
+
+Instructions run in one batch per 60Hz frame instead of being paced one at a time,
+the budget is tick_rate / 60 with the remainder carried so the long run average is exact
+
+Frame n is due at start + n * 1000000 / 60 microseconds on the monotonic clock, deadlines
+are computed from the frame number rather than added up so rounding never drifts
+
+If the host stalls and more than SCHEDULER_MAX_CATCH_UP frames are due at once the missed
+frames are dropped and the schedule restarts from now, so a slow host can't fall further
+and further behind trying to run every frame it missed
+
+The speed scales how often frames are due, in SPEED_ONE units so 2 * SPEED_ONE is twice
+as fast and SPEED_ONE / 4 is quarter speed. Every frame still runs one budget and ticks the
+timers once, so instructions and timers speed up and slow down together
+
+While the emulator has nothing to run it sleeps instead of asking for frames, once it
+wakes scheduler_resume starts the schedule again from now so the time asleep doesn't
+count as missed frames
 */
 
-struct timer
+#define FRAME_RATE 60
+#define SCHEDULER_MAX_CATCH_UP 4 // In frames at normal speed
+#define SPEED_ONE 256
+#define HISTOGRAM_BUCKETS 32
+
+struct histogram
 {
-    u64 _delay_us;
-    u64 _last_tick;
+    u64 bucket_us; // Width of each bucket, the last bucket takes everything above
+    u64 counts[HISTOGRAM_BUCKETS];
+    u64 samples;
+    u64 sum_us;
+    u64 min_us;
+    u64 max_us;
 };
 
-void init_timers();
+struct frame_scheduler
+{
+    u32 per_frame;
+    u32 remainder;
+    u32 carry;
+    u32 speed; // Out of SPEED_ONE
+
+    u64 start_us;
+    u64 frame; // Frames since start_us that have been handed out
+
+    // Stats
+    u64 last_frame_us; // 0 when there is no previous frame to time against
+    u64 frames_run;
+    u64 frames_dropped;
+    struct histogram frame_time; // Between the starts of consecutive frames
+    struct histogram jitter; // How late each frame started
+};
 
-void create_timer_us(struct timer *timer, u64 delay_us);
+void create_scheduler(struct frame_scheduler *scheduler, u32 tick_rate);
+u32 scheduler_frames_due(struct frame_scheduler *scheduler); // Frames to run now, 0 if the next one isn't due yet
+u32 scheduler_budget(struct frame_scheduler *scheduler); // Instructions to run in the next frame
+u64 scheduler_next_deadline_us(struct frame_scheduler *scheduler); // When the next frame is due on the pf_get_time_us clock
+void scheduler_resume(struct frame_scheduler *scheduler); // Next frame is due now, later ones follow on from it
+void scheduler_set_speed(struct frame_scheduler *scheduler, u32 speed); // Takes effect from the next frame
+void print_scheduler_report(struct frame_scheduler *scheduler);
 
-// Returns whether the timer should tick
-u8 should_tick(struct timer *timer);
+void init_histogram(struct histogram *histogram, u64 bucket_us);
+void histogram_add(struct histogram *histogram, u64 us);
+void print_histogram(const char *name, struct histogram *histogram);
 
 #endif //_TIMER_H_
\ No newline at end of file
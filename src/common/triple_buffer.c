@@ -0,0 +1,39 @@
+#include "triple_buffer.h"
+
+#include <string.h>
+
+#define TB_FRESH 0x4
+
+void tb_init(struct triple_buffer *tb)
+{
+    memset(tb->frames, 0, sizeof(tb->frames));
+    tb->write = 0;
+    tb->read = 2;
+    tb->published = 0;
+    SDL_AtomicSet(&tb->middle, 1);
+}
+
+struct frame *tb_write_frame(struct triple_buffer *tb)
+{
+    return &tb->frames[tb->write];
+}
+
+void tb_publish(struct triple_buffer *tb)
+{
+    tb->frames[tb->write].number = ++tb->published;
+
+    // The frame has to be written before the reader can see it
+    SDL_MemoryBarrierRelease();
+    int old = SDL_AtomicSet(&tb->middle, tb->write | TB_FRESH);
+    tb->write = old & ~TB_FRESH;
+}
+
+struct frame *tb_acquire(struct triple_buffer *tb)
+{
+    if (!(SDL_AtomicGet(&tb->middle) & TB_FRESH)) return NULL;
+
+    int old = SDL_AtomicSet(&tb->middle, tb->read);
+    SDL_MemoryBarrierAcquire();
+    tb->read = old & ~TB_FRESH;
+    return &tb->frames[tb->read];
+}
\ No newline at end of file
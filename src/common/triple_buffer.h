@@ -0,0 +1,44 @@
+#ifndef _TRIPLE_BUFFER_H_
+#define _TRIPLE_BUFFER_H_
+
+#include "types.h"
+#include "chip8.h"
+
+#include <SDL_atomic.h>
+
+/*
+Lock free triple buffer handing frames from the emulator to the render thread
+
+The writer always owns one buffer and the reader owns another, the third sits in the middle.
+Publishing swaps the writer's buffer with the middle one and marks it fresh, acquiring swaps
+the reader's buffer with the middle one if it's fresh
+
+Neither side ever waits for the other, the writer drops frames the reader never got round to
+and the reader keeps its last frame until a newer one is published
+*/
+
+struct frame
+{
+    u64 rows[DISPLAY_HEIGHT];
+    u64 number; // Counts published frames from 1
+};
+
+struct triple_buffer
+{
+    struct frame frames[3];
+    SDL_atomic_t middle; // Index of the middle buffer, TB_FRESH is set until the reader takes it
+    int write; // Only touched by the writer
+    int read; // Only touched by the reader
+    u64 published;
+};
+
+void tb_init(struct triple_buffer *tb);
+
+// Writer
+struct frame *tb_write_frame(struct triple_buffer *tb); // Buffer to fill before tb_publish
+void tb_publish(struct triple_buffer *tb);
+
+// Reader
+struct frame *tb_acquire(struct triple_buffer *tb); // Newest frame, NULL if nothing was published since the last call
+
+#endif //_TRIPLE_BUFFER_H_
\ No newline at end of file
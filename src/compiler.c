@@ -0,0 +1,482 @@
+// Compiles a rom ahead of time into a shared library that c8 can load with -a
+
+#include "common/types.h"
+#include "common/chip8.h"
+#include "common/instructions.h"
+#include "common/aot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef C8_AOT_INCLUDE_DIR
+#define C8_AOT_INCLUDE_DIR "src/common"
+#endif
+
+#define ROM_START 0x200
+#define MAX_BLOCK_INSTRUCTIONS 64
+
+struct args
+{
+    const char *path;
+    const char *out;
+    const char *include_dir;
+};
+
+enum op_kind
+{
+    OP_UNKNOWN, // Ends the block before the instruction, left to the interpreter
+    OP_NATIVE,
+    OP_HELPER,
+    OP_END_NATIVE,
+    OP_END_HELPER,
+};
+
+static u8 rom[MEMORY_SIZE];
+static int rom_size;
+
+static u8 queued[MEMORY_SIZE];
+static u16 worklist[MEMORY_SIZE];
+static int worklist_size;
+
+static u16 blocks[MEMORY_SIZE];
+static int block_count;
+
+int compile(struct args *args);
+
+int main(int argc, char *argv[])
+{
+    struct args args = {0};
+    for (int i = 1; i < argc; i++)
+    {
+        const char *str = argv[i];
+        if (str[0] == '-')
+        {
+            if (str[1] == 'i')
+            {
+                args.include_dir = str + 2;
+            }
+            else
+            {
+                printf("Unknown flag: %c\n", str[1]);
+                return 1;
+            }
+        }
+        else if (args.path == NULL)
+        {
+            args.path = str;
+        }
+        else if (args.out == NULL)
+        {
+            args.out = str;
+        }
+        else
+        {
+            printf("Too many paths specified\n");
+            return 1;
+        }
+    }
+
+    if (args.path == NULL)
+    {
+        printf("Usage: c8aot <rom_path> <out_path:optional>\n\t-i\"<dir>\" directory containing aot.h\n");
+        return 1;
+    }
+    if (args.out == NULL) args.out = "a.so";
+    if (args.include_dir == NULL) args.include_dir = C8_AOT_INCLUDE_DIR;
+
+    printf("Compiling \"%s\" into \"%s\"\n", args.path, args.out);
+    return compile(&args);
+}
+
+static u8 in_rom(u16 address)
+{
+    return address >= ROM_START && address + 1 < ROM_START + rom_size;
+}
+
+static void decode_at(u16 address, struct instruction *instruction)
+{
+    u16 instruction_bytes = ((u16)rom[address - ROM_START] << 8) + (u16)rom[address - ROM_START + 1];
+    decode_instruction(instruction_bytes, instruction);
+}
+
+static void queue(u16 address)
+{
+    if (!in_rom(address) || queued[address]) return;
+    queued[address] = 1;
+    worklist[worklist_size++] = address;
+}
+
+static enum op_kind classify(struct instruction *in)
+{
+    switch(in->i)
+    {
+    case 0x0:
+        if (in->NNN == 0x000 || in->NNN == 0x0EE) return OP_END_HELPER;
+        return OP_HELPER;
+    case 0x1:
+    case 0x3:
+    case 0x4:
+        return OP_END_NATIVE;
+    case 0x5:
+    case 0x9:
+        return in->N == 0 ? OP_END_NATIVE : OP_UNKNOWN;
+    case 0x6:
+    case 0x7:
+    case 0xA:
+        return OP_NATIVE;
+    case 0x8:
+        return (in->N <= 0x7 || in->N == 0xE) ? OP_NATIVE : OP_UNKNOWN;
+    case 0x2:
+    case 0xB:
+    case 0xD:
+        return OP_END_HELPER;
+    case 0xC:
+        return OP_HELPER;
+    case 0xE:
+        return (in->NN == 0x9E || in->NN == 0xA1) ? OP_END_HELPER : OP_UNKNOWN;
+    case 0xF:
+        switch(in->NN)
+        {
+        case 0x07:
+        case 0x15:
+        case 0x18:
+        case 0x29:
+        case 0x1E:
+            return OP_NATIVE;
+        case 0x65:
+            return OP_HELPER;
+        case 0x55:
+        case 0x33:
+        case 0x0A:
+            return OP_END_HELPER;
+        }
+        return OP_UNKNOWN;
+    }
+    return OP_UNKNOWN;
+}
+
+// Queues every address execution can continue at after a block ending in this instruction
+static void queue_successors(struct instruction *in, u16 address)
+{
+    switch(in->i)
+    {
+    case 0x0:
+        break; // Halt and return
+    case 0x1:
+        queue(in->NNN);
+        break;
+    case 0x2:
+        queue(in->NNN);
+        queue(address + 2);
+        break;
+    case 0x3:
+    case 0x4:
+    case 0x5:
+    case 0x9:
+    case 0xE:
+        queue(address + 2);
+        queue(address + 4);
+        break;
+    case 0xB:
+        break; // Target depends on v0
+    default:
+        queue(address + 2);
+        break;
+    }
+}
+
+// Finds block boundaries by following control flow from the entry point
+static void find_blocks()
+{
+    queue(ROM_START);
+    while (worklist_size > 0)
+    {
+        u16 start = worklist[--worklist_size];
+        blocks[block_count++] = start;
+
+        u16 address = start;
+        for (int n = 0; n < MAX_BLOCK_INSTRUCTIONS && in_rom(address); n++)
+        {
+            struct instruction in;
+            decode_at(address, &in);
+            enum op_kind kind = classify(&in);
+            if (kind == OP_UNKNOWN) break;
+            if (kind == OP_END_NATIVE || kind == OP_END_HELPER)
+            {
+                queue_successors(&in, address);
+                break;
+            }
+            address += 2;
+            if (n == MAX_BLOCK_INSTRUCTIONS - 1) queue(address);
+        }
+    }
+}
+
+// Number of instructions in the block starting at start
+static int block_length(u16 start)
+{
+    u16 address = start;
+    int n = 0;
+    while (n < MAX_BLOCK_INSTRUCTIONS && in_rom(address))
+    {
+        struct instruction in;
+        decode_at(address, &in);
+        enum op_kind kind = classify(&in);
+        if (kind == OP_UNKNOWN) break;
+        n++;
+        address += 2;
+        if (kind == OP_END_NATIVE || kind == OP_END_HELPER) break;
+    }
+    return n;
+}
+
+static int block_index[MEMORY_SIZE]; // Index into blocks + 1, 0 if no block starts at the address
+
+static void write_save(FILE *file, u16 mask)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        if (mask & (1 << x)) fprintf(file, " v[0x%X] = v%X;", x, x);
+    }
+}
+
+static void write_load(FILE *file, u16 mask)
+{
+    for (int x = 0; x < 16; x++)
+    {
+        if (mask & (1 << x)) fprintf(file, " v%X = v[0x%X];", x, x);
+    }
+}
+
+// Registers an instruction run through execute reads and writes, so only those are synced around the call
+static void helper_registers(struct instruction *in, u16 *reads, u16 *writes)
+{
+    u16 vx = 1 << in->x;
+    u16 vy = 1 << in->y;
+    *reads = 0;
+    *writes = 0;
+    switch(in->i)
+    {
+    case 0x0:
+    case 0x2:
+        break;
+    case 0xB:
+        *reads = 1;
+        break;
+    case 0xC:
+        *writes = vx;
+        break;
+    case 0xD:
+        *reads = vx | vy;
+        *writes = 0x8000;
+        break;
+    case 0xE:
+        *reads = vx;
+        break;
+    case 0xF:
+        switch(in->NN)
+        {
+        case 0x33: *reads = vx; break;
+        case 0x55: *reads = (u16)((2 << in->x) - 1); break;
+        case 0x65: *writes = (u16)((2 << in->x) - 1); break;
+        }
+        break;
+    default:
+        *reads = 0xFFFF;
+        *writes = 0xFFFF;
+        break;
+    }
+}
+
+// Continues at target, straight into its block when there is one
+static void write_goto(FILE *file, u16 target)
+{
+    if (target < MEMORY_SIZE && block_index[target])
+        fprintf(file, " *e->pc = 0x%04X; goto block_%04X;", target, target);
+    else
+        fprintf(file, " *e->pc = 0x%04X; goto dispatch;", target);
+}
+
+static void write_native(FILE *file, struct instruction *in)
+{
+    u8 x = in->x;
+    u8 y = in->y;
+    switch(in->i)
+    {
+    case 0x6:
+        fprintf(file, "v%X = 0x%02X;", x, in->NN);
+        break;
+    case 0x7:
+        fprintf(file, "v%X = (u8)(v%X + 0x%02X);", x, x, in->NN);
+        break;
+    case 0x8:
+        switch(in->N)
+        {
+        case 0x0: fprintf(file, "v%X = v%X;", x, y); break;
+        case 0x1: fprintf(file, "v%X |= v%X;", x, y); break;
+        case 0x2: fprintf(file, "v%X &= v%X;", x, y); break;
+        case 0x3: fprintf(file, "v%X ^= v%X;", x, y); break;
+        case 0x4: fprintf(file, "{ u32 sum = (u32)v%X + (u32)v%X; vF = (sum > 255); v%X = (u8)sum; }", x, y, x); break;
+        case 0x5: fprintf(file, "vF = (v%X >= v%X); v%X = (u8)(v%X - v%X);", x, y, x, x, y); break;
+        case 0x6: fprintf(file, "v%X = v%X >> 1; vF = v%X & 0x1;", x, x, x); break;
+        case 0x7: fprintf(file, "vF = (v%X >= v%X); v%X = (u8)(v%X - v%X);", y, x, x, y, x); break;
+        case 0xE: fprintf(file, "v%X = (u8)(v%X << 1); vF = (v%X >> 7) & 0x1;", x, x, x); break;
+        }
+        break;
+    case 0xA:
+        fprintf(file, "*e->i = 0x%03X;", in->NNN);
+        break;
+    case 0xF:
+        switch(in->NN)
+        {
+        case 0x07: fprintf(file, "v%X = *e->delay;", x); break;
+        case 0x15: fprintf(file, "*e->delay = v%X;", x); break;
+        case 0x18: fprintf(file, "*e->sound = v%X;", x); break;
+        case 0x29: fprintf(file, "*e->i = 0x50 + 5 * (v%X & 0xF);", x); break;
+        case 0x1E: fprintf(file, "*e->i = (u16)(*e->i + v%X); if (*e->i >= 0x1000) vF = 1;", x); break;
+        }
+        break;
+    }
+}
+
+static void write_block(FILE *file, int index, u16 start, int length)
+{
+    fprintf(file, "block_%04X:\n    if (budget - n < %d || !e->valid[%d]) goto leave;\n    n += %d;\n", start, length, index, length);
+
+    for (int n = 0; n < length; n++)
+    {
+        struct instruction in;
+        u16 address = start + 2 * n;
+        u16 next = address + 2;
+        decode_at(address, &in);
+        enum op_kind kind = classify(&in);
+        u16 reads, writes;
+        fprintf(file, "    /* %04X: %04X */ ", address, in.instruction);
+
+        switch(kind)
+        {
+        case OP_NATIVE:
+            write_native(file, &in);
+            if (n == length - 1) write_goto(file, next);
+            break;
+        case OP_HELPER:
+        case OP_END_HELPER:
+            helper_registers(&in, &reads, &writes);
+            write_save(file, reads | writes); // Saved as well in case execute leaves a register alone
+            fprintf(file, " *e->pc = 0x%04X; e->execute(e->state, 0x%04X);", next, in.instruction);
+            write_load(file, writes);
+            if (kind == OP_END_HELPER && in.i == 0x2)
+                write_goto(file, in.NNN); // Calls can't halt, wait or write memory
+            else if (kind == OP_END_HELPER)
+                fprintf(file, " if (*e->halt || *e->await_input || *e->code_modified) goto leave; goto dispatch;");
+            else if (n == length - 1)
+                write_goto(file, next);
+            break;
+        case OP_END_NATIVE:
+            switch(in.i)
+            {
+            case 0x1: write_goto(file, in.NNN); break;
+            case 0x3: fprintf(file, "if (v%X == 0x%02X) {", in.x, in.NN); break;
+            case 0x4: fprintf(file, "if (v%X != 0x%02X) {", in.x, in.NN); break;
+            case 0x5: fprintf(file, "if (v%X == v%X) {", in.x, in.y); break;
+            case 0x9: fprintf(file, "if (v%X != v%X) {", in.x, in.y); break;
+            }
+            if (in.i != 0x1)
+            {
+                write_goto(file, address + 4);
+                fprintf(file, " }");
+                write_goto(file, next);
+            }
+            break;
+        default:
+            break;
+        }
+        fprintf(file, "\n");
+    }
+    fprintf(file, "\n");
+}
+
+int compile(struct args *args)
+{
+    FILE *rom_file = fopen(args->path, "rb");
+    if (rom_file == NULL)
+    {
+        printf("Failed to open rom file: %s\n", args->path);
+        return 1;
+    }
+    rom_size = (int)fread(rom, 1, MEMORY_SIZE - ROM_START, rom_file);
+    fclose(rom_file);
+
+    find_blocks();
+    printf("Found %d basic blocks in %d bytes\n", block_count, rom_size);
+
+    char c_path[1024];
+    snprintf(c_path, sizeof(c_path), "%s.c", args->out);
+    FILE *file = fopen(c_path, "w");
+    if (file == NULL)
+    {
+        printf("Failed to open %s\n", c_path);
+        return 1;
+    }
+
+    int lengths[MEMORY_SIZE];
+    int written = 0;
+    for (int b = 0; b < block_count; b++)
+    {
+        lengths[b] = block_length(blocks[b]);
+        if (lengths[b] > 0) block_index[blocks[b]] = ++written;
+    }
+
+    fprintf(file, "// Generated by c8aot from %s\n\n#include \"aot.h\"\n\n", args->path);
+
+    fprintf(file, "static const struct aot_block blocks[] = {\n");
+    for (int b = 0; b < block_count; b++)
+    {
+        if (lengths[b] > 0) fprintf(file, "    { 0x%04X, %d },\n", blocks[b], lengths[b]);
+    }
+    fprintf(file, "};\n\nstatic const u8 rom[] = {");
+    for (int i = 0; i < rom_size; i++)
+    {
+        fprintf(file, "%s0x%02X,", (i % 16 == 0) ? "\n    " : " ", rom[i]);
+    }
+    fprintf(file, "\n};\n\n");
+
+    fprintf(file, "static u64 run(const struct aot_env *e, u64 budget)\n{\n    u8 *v = e->v;\n    u64 n = 0;\n   ");
+    for (int x = 0; x < 16; x++)
+    {
+        fprintf(file, " u8 v%X;", x);
+    }
+    fprintf(file, "\n   ");
+    write_load(file, 0xFFFF);
+    fprintf(file, "\n\ndispatch:\n    switch(*e->pc)\n    {\n");
+    for (int b = 0; b < block_count; b++)
+    {
+        if (lengths[b] > 0) fprintf(file, "    case 0x%04X: goto block_%04X;\n", blocks[b], blocks[b]);
+    }
+    fprintf(file, "    default: goto leave;\n    }\n\n");
+
+    for (int b = 0; b < block_count; b++)
+    {
+        if (lengths[b] > 0) write_block(file, block_index[blocks[b]] - 1, blocks[b], lengths[b]);
+    }
+
+    fprintf(file, "leave:\n   ");
+    write_save(file, 0xFFFF);
+    fprintf(file, "\n    return n;\n}\n\n");
+    fprintf(file, "const struct aot_module %s = { AOT_ABI_VERSION, %d, blocks, 0x%04X, %d, rom, run };\n", AOT_MODULE_SYMBOL, written, ROM_START, rom_size);
+    fclose(file);
+
+    const char *cc = getenv("CC");
+    if (cc == NULL) cc = "cc";
+
+    char command[4096];
+    snprintf(command, sizeof(command), "%s -O2 -shared -fPIC -I\"%s\" -o \"%s\" \"%s\"", cc, args->include_dir, args->out, c_path);
+    printf("%s\n", command);
+    if (system(command) != 0)
+    {
+        printf("Failed to compile %s\n", c_path);
+        return 1;
+    }
+    return 0;
+}
\ No newline at end of file
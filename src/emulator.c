@@ -5,6 +5,13 @@
 #include "common/chip8.h"
 #include "common/platform.h"
 #include "common/timer.h"
+#include "common/engine.h"
+#include "common/aot.h"
+#include "common/snapshot.h"
+#include "common/rewind.h"
+#include "common/movie.h"
+#include "common/runahead.h"
+#include "common/netplay.h"
 
 #define SDL_MAIN_HANDLED
 #include <SDL.h>
@@ -14,13 +21,65 @@
 #include <string.h>
 
 static struct chip8 state;
+static struct histogram input_latency; // From a key event to the start of the first frame that sees it
+static struct histogram screen_latency; // From a key event to showing the first frame that saw it
+static u64 unshown_event_us; // Earliest key event seen by a frame that hasn't been shown yet, 0 if there isn't one
+static struct runahead ahead;
+static u8 snapshot_buffer[SNAPSHOT_MAX_SIZE];
 
 struct args
 {
     const char *rom_path;
     const char *font_path;
+    const char *keymap_path;
     u32 tick_rate;
     u8 debug;
+    u8 engine_set;
+    enum engine engine;
+    const char *aot_path;
+    u8 scale_set;
+    u8 phosphor_set;
+    struct render_options render;
+    u8 idle_set;
+    u8 skip_idle;
+    u8 speed_set;
+    u32 speed;
+    u8 turbo;
+    u8 start_paused;
+    u8 audio_set;
+    struct audio_options audio;
+    u8 resume_set;
+    int resume_slot;
+    u8 rewind_set;
+    u32 rewind_mb;
+    const char *record_path;
+    const char *replay_path;
+    u8 seed_set;
+    u32 seed;
+    u8 runahead_set;
+    u32 runahead;
+    int player; // 0 when not linked
+    u16 port;
+};
+
+#define SPEED_MIN (SPEED_ONE / 64)
+#define SPEED_MAX (SPEED_ONE * 64)
+
+#define TURBO_SLICE_US (1000000 / FRAME_RATE)
+#define PRESENT_MIN_GAP_US (3 * 1000000 / (4 * FRAME_RATE)) // Under a frame so 1x speed never skips one
+
+struct speed_control
+{
+    u8 paused;
+    u8 turbo; // Run as fast as the host allows
+    u32 speed; // Out of SPEED_ONE, ignored in turbo
+};
+
+enum step
+{
+    STEP_NONE,
+    STEP_FRAME,
+    STEP_INSTRUCTION,
 };
 
 int emulate(struct args *args);
@@ -51,6 +110,17 @@ int main(int argc, char *argv[])
                         return 1;
                     }
                     break;
+                case 'k':
+                    if (args.keymap_path == NULL)
+                    {
+                        args.keymap_path = str + 2;
+                    }
+                    else
+                    {
+                        printf("-k flag defined twice\n");
+                        return 1;
+                    }
+                    break;
                 case 'd':
                     if (args.debug == 0)
                     {
@@ -72,6 +142,252 @@ int main(int argc, char *argv[])
                         printf("-t flag defined twice\n");
                         return 1;
                     }
+                    break;
+                case 's':
+                    if (args.scale_set == 0)
+                    {
+                        if (strcmp(str + 2, "integer") == 0)
+                        {
+                            args.render.scale = SCALE_INTEGER;
+                        }
+                        else if (strcmp(str + 2, "fit") == 0)
+                        {
+                            args.render.scale = SCALE_FIT;
+                        }
+                        else
+                        {
+                            printf("Unknown scale mode: %s\n", str + 2);
+                            return 1;
+                        }
+                        args.scale_set = 1;
+                    }
+                    else
+                    {
+                        printf("-s flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'p':
+                    if (args.phosphor_set == 0)
+                    {
+                        int phosphor = atoi(str + 2);
+                        if (phosphor < 0 || phosphor > 255)
+                        {
+                            printf("Phosphor should be between 0 and 255\n");
+                            return 1;
+                        }
+                        args.render.phosphor = (u8)phosphor;
+                        args.phosphor_set = 1;
+                    }
+                    else
+                    {
+                        printf("-p flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'i':
+                    if (args.idle_set == 0)
+                    {
+                        args.skip_idle = (u8)(atoi(str + 2) != 0);
+                        args.idle_set = 1;
+                    }
+                    else
+                    {
+                        printf("-i flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'm':
+                    if (args.speed_set == 0)
+                    {
+                        if (strcmp(str + 2, "turbo") == 0)
+                        {
+                            args.turbo = 1;
+                            args.speed = SPEED_ONE;
+                        }
+                        else
+                        {
+                            f64 speed = atof(str + 2);
+                            if (speed * SPEED_ONE < SPEED_MIN || speed * SPEED_ONE > SPEED_MAX)
+                            {
+                                printf("Speed should be turbo or between %g and %g\n", (f64)SPEED_MIN / SPEED_ONE, (f64)SPEED_MAX / SPEED_ONE);
+                                return 1;
+                            }
+                            args.speed = (u32)(speed * SPEED_ONE + 0.5);
+                        }
+                        args.speed_set = 1;
+                    }
+                    else
+                    {
+                        printf("-m flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'l':
+                    if (args.audio_set == 0)
+                    {
+                        int samples = atoi(str + 2);
+                        if (samples < 0 || samples > 8192)
+                        {
+                            printf("Audio buffer should be between 0 and 8192 samples\n");
+                            return 1;
+                        }
+                        args.audio.buffer_samples = (u16)samples;
+                        args.audio_set = 1;
+                    }
+                    else
+                    {
+                        printf("-l flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'r':
+                    if (args.resume_set == 0)
+                    {
+                        args.resume_slot = atoi(str + 2);
+                        if (args.resume_slot < 0 || args.resume_slot >= SNAPSHOT_SLOTS)
+                        {
+                            printf("Slot should be between 0 and %d\n", SNAPSHOT_SLOTS - 1);
+                            return 1;
+                        }
+                        args.resume_set = 1;
+                    }
+                    else
+                    {
+                        printf("-r flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'j':
+                    if (args.runahead_set == 0)
+                    {
+                        int frames = atoi(str + 2);
+                        if (frames < 0 || frames > RUNAHEAD_MAX_FRAMES)
+                        {
+                            printf("Run-ahead should be between 0 and %d frames\n", RUNAHEAD_MAX_FRAMES);
+                            return 1;
+                        }
+                        args.runahead = (u32)frames;
+                        args.runahead_set = 1;
+                    }
+                    else
+                    {
+                        printf("-j flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'u':
+                    if (args.player == 0)
+                    {
+                        // -u<player>[:port]
+                        char *end;
+                        args.player = (int)strtol(str + 2, &end, 10);
+                        args.port = NETPLAY_PORT;
+                        if (*end == ':') args.port = (u16)strtoul(end + 1, &end, 10);
+                        if ((args.player != 1 && args.player != 2) || *end != 0 || args.port == 0 || args.port == 0xFFFF)
+                        {
+                            printf("-u should be 1 or 2, optionally followed by :<port>\n");
+                            return 1;
+                        }
+                    }
+                    else
+                    {
+                        printf("-u flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'g':
+                    if (args.seed_set == 0)
+                    {
+                        args.seed = (u32)strtoul(str + 2, NULL, 10);
+                        args.seed_set = 1;
+                    }
+                    else
+                    {
+                        printf("-g flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'w':
+                    if (args.rewind_set == 0)
+                    {
+                        int mb = atoi(str + 2);
+                        if (mb < 0 || mb > 1024)
+                        {
+                            printf("Rewind buffer should be between 0 and 1024 MB\n");
+                            return 1;
+                        }
+                        args.rewind_mb = (u32)mb;
+                        args.rewind_set = 1;
+                    }
+                    else
+                    {
+                        printf("-w flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'o':
+                    if (args.record_path == NULL)
+                    {
+                        args.record_path = str + 2;
+                    }
+                    else
+                    {
+                        printf("-o flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'y':
+                    if (args.replay_path == NULL)
+                    {
+                        args.replay_path = str + 2;
+                    }
+                    else
+                    {
+                        printf("-y flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'b':
+                    if (args.start_paused == 0)
+                    {
+                        args.start_paused = 1;
+                    }
+                    else
+                    {
+                        printf("-b flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'a':
+                    if (args.aot_path == NULL)
+                    {
+                        args.aot_path = str + 2;
+                        args.engine = ENGINE_AOT;
+                        args.engine_set = 1;
+                    }
+                    else
+                    {
+                        printf("-a flag defined twice\n");
+                        return 1;
+                    }
+                    break;
+                case 'e':
+                    if (args.engine_set == 0)
+                    {
+                        if (!parse_engine(str + 2, &args.engine))
+                        {
+                            printf("Unknown engine: %s\n", str + 2);
+                            return 1;
+                        }
+                        args.engine_set = 1;
+                    }
+                    else
+                    {
+                        printf("-e flag defined twice\n");
+                        return 1;
+                    }
+                    break;
                 default:
                     printf("Unknown flag: %c\n", flag);
                 }
@@ -90,160 +406,477 @@ int main(int argc, char *argv[])
             }
         }
 
-        if (args.rom_path == NULL)
+        if (args.rom_path == NULL && args.replay_path == NULL)
         {
             printf("No rom path specified\n");
             return 1;
         }
 
+        if (args.replay_path != NULL && (args.record_path != NULL || args.resume_set || args.seed_set))
+        {
+            printf("-y can't be used with -o, -r or -g, a recording starts from its own state\n");
+            return 1;
+        }
+
+        if (args.player != 0 && (args.record_path != NULL || args.replay_path != NULL))
+        {
+            printf("-u can't be used with -o or -y, the other player's keys aren't recorded\n");
+            return 1;
+        }
+
+        if (args.rom_path == NULL)
+        {
+            args.rom_path = args.replay_path;
+        }
+
         if (args.font_path == NULL)
         {
             printf("No font path specified, choosing default\n");
             args.font_path = "fonts/default.font";
         }
 
+        if (args.keymap_path == NULL)
+        {
+            printf("No keymap path specified, choosing default\n");
+            args.keymap_path = "keymaps/default.keymap";
+        }
+
         if (args.tick_rate == 0)
         {
             printf("No tick rate specified, choosing default\n");
             args.tick_rate = 1000;
         }
 
-        printf("Rom path: %s\nFont path: %s\nDebug mode: %d\nTick rate: %d\n", args.rom_path, args.font_path, (int)args.debug, (int)args.tick_rate);
+        if (args.engine_set == 0)
+        {
+            args.engine = ENGINE_THREADED;
+        }
+
+        if (args.idle_set == 0)
+        {
+            args.skip_idle = 1;
+        }
+
+        if (args.speed_set == 0)
+        {
+            args.speed = SPEED_ONE;
+        }
+
+        if (args.audio_set == 0)
+        {
+            args.audio.buffer_samples = 512;
+        }
+
+        if (args.rewind_set == 0)
+        {
+            args.rewind_mb = 16;
+        }
+
+        printf("Rom path: %s\nFont path: %s\nDebug mode: %d\nTick rate: %d\nEngine: %s\n", args.rom_path, args.font_path, (int)args.debug, (int)args.tick_rate, engine_names[args.engine]);
         printf("\n");
         return emulate(&args);
     }
 
-    printf("Usage: chip8 <rom_path>\n\t-f\"<font_path>\"\n\t-d enable debugging\n\t-t<tps> sets tick rate\n");
+    printf("Usage: chip8 <rom_path>\n\t-f\"<font_path>\"\n\t-k\"<keymap_path>\"\n\t-d enable debugging\n\t-t<tps> sets tick rate\n\t-e<engine> uncached, switch, threaded, jit, aot or fused\n\t-a\"<library>\" run a rom compiled by c8aot\n\t-s<mode> integer (default) or fit scaling\n\t-p<0-255> phosphor, how much brightness a pixel keeps each frame after turning off\n\t-i<0|1> skip loops that only wait for the next frame, on by default\n\t-m<speed> turbo, or a multiple of normal speed like 0.25 or 4\n\t-b start paused\n\t-l<samples> audio buffer size, smaller is lower latency, 0 turns sound off (default 512)\n\t-r<slot> resume from a save state slot (0-9)\n\t-w<MB> rewind buffer size, 0 turns rewind off (default 16)\n\t-j<frames> run ahead this many frames to hide input lag, 0 (default) to %d\n\t-g<seed> seed for the random number generator, a new one every run by default\n\t-o\"<recording>\" record the seed and keypad to a file\n\t-y\"<recording>\" replay a recording, no rom needed\n\t-u<1|2>[:port] link two players on this machine over UDP, player 1 listens on the port (default %d) and player 2 on the next\n", RUNAHEAD_MAX_FRAMES, NETPLAY_PORT);
     return 1;
 }
 
-int emulate(struct args *args)
+struct host_usage
 {
-    // Init platform code
-    init_platform();
+    u64 start_us;
+    u64 start_cpu_us;
+    u64 parked_us;
+    u64 parked_cpu_us;
+};
 
-    // Init CPU
-    init_chip8(&state);
+static void start_usage(struct host_usage *usage)
+{
+    usage->start_us = pf_get_time_us();
+    usage->start_cpu_us = pf_get_cpu_time_us();
+    usage->parked_us = 0;
+    usage->parked_cpu_us = 0;
+}
 
-    // Load rom into memory at location 0x200
-    printf("Loading rom: \"%s\"\n", args->rom_path);
+static void print_usage(struct host_usage *usage)
+{
+    u64 wall = pf_get_time_us() - usage->start_us;
+    u64 cpu = pf_get_cpu_time_us() - usage->start_cpu_us;
+    u64 running = wall - usage->parked_us;
+    u64 running_cpu = cpu > usage->parked_cpu_us ? cpu - usage->parked_cpu_us : 0;
+
+    // Percent of one core, the render thread's time included
+    printf("Host CPU: %.1f%% over %.1f s running, %.1f%% over %.1f s parked\n",
+        running ? 100.0 * running_cpu / running : 0.0, running / 1000000.0,
+        usage->parked_us ? 100.0 * usage->parked_cpu_us / usage->parked_us : 0.0, usage->parked_us / 1000000.0);
+}
 
-    FILE *rom_file;
-    if (fopen_s(&rom_file, args->rom_path, "rb") != 0)
+// Takes input from the platform, edges build up until a frame sees them
+static void gather_input(struct input *input)
+{
+    struct input polled;
+    pf_take_input(&polled);
+    input->held = polled.held;
+    input->pressed |= polled.pressed;
+    input->released |= polled.released;
+    input->hotkeys = polled.hotkeys; // Handled straight away, never carried over
+    input->hotkeys_held = polled.hotkeys_held;
+    if (input->first_event_us == 0) input->first_event_us = polled.first_event_us;
+}
+
+// Runs one 60Hz frame of instructions then ticks the timers
+static void run_frame(struct args *args, struct frame_scheduler *scheduler, struct input *input)
+{
+    if (state.halt || netplay_waiting()) return;
+    rewind_capture(&state);
+
+    u32 budget = scheduler_budget(scheduler);
+    u16 held = input->held;
+    u16 pressed = input->pressed;
+    movie_frame(&state, &held, &pressed); // Logs them while recording, replaces them while replaying
+    netplay_frame(&state, budget, &held, &pressed); // Saves the frame and adds the other player's keys
+    u8 key = set_frame_keys(&state, held, pressed);
+    if (key != 0xFF && args->debug)
     {
-        printf("Failed to open rom file: %s\n", args->rom_path);
-        return 1;
+        printf("Saving key %#03x into register v[%x]\n", key, state.input_register);
     }
-    
-    fseek(rom_file, 0, SEEK_END);
-    int rom_size = (int)ftell(rom_file);
-    fseek(rom_file, 0, SEEK_SET);
-    
-    if (rom_size - 512 > MEMORY_SIZE)
+    if (input->first_event_us != 0)
     {
-        printf("Rom size is %d bytes which is too large to fit in memory\n", rom_size);
-        return 1;
+        u64 now = pf_get_time_us();
+        histogram_add(&input_latency, now > input->first_event_us ? now - input->first_event_us : 0);
+        if (unshown_event_us == 0) unshown_event_us = input->first_event_us;
     }
+    input->pressed = 0;
+    input->released = 0;
+    input->first_event_us = 0;
 
-    printf("Rom size is %d bytes, reading into memory\n\n", rom_size);
+    if (args->debug)
+    {
+        for (u32 n = 0; n < budget && !state.halt && !state.await_input; n++)
+        {
+            struct instruction *instruction = fetch_decoded(&state);
+            if (!execute_instruction(&state, instruction))
+            {
+                state.halt = 1;
+            }
+            if (!debug_instruction(&state, instruction))
+            {
+                state.halt = 1;
+            }
+            state.cycles++;
+        }
+    }
+    else
+    {
+        run_engine(&state, args->engine, budget);
+    }
 
-    fread(&state.memory[0x200], 1, rom_size, rom_file);
-    fclose(rom_file);
+    pf_queue_sound(state.cpu.sound > 0);
+    tick_timers(&state);
+}
 
-    // print_memory(0x200, 160, 16);
+// Runs the next frame, or goes back one while rewind is held and there's one left
+static void advance_frame(struct args *args, struct frame_scheduler *scheduler, struct input *input, u8 rewinding)
+{
+    if (rewinding && rewind_step(&state))
+    {
+        pf_queue_sound(0);
+        return;
+    }
+    run_frame(args, scheduler, input);
+}
 
-    // Setup font
-    printf("Loading font: %s\n", args->font_path);
+// Runs a single instruction and prints it, whether or not debugging is on
+static void step_instruction()
+{
+    if (state.halt || state.await_input || movie_playing() || netplay_active()) return;
 
-    FILE *font_file;
-    if (fopen_s(&font_file, args->font_path, "rb") != 0)
+    struct instruction *instruction = fetch_decoded(&state);
+    if (!execute_instruction(&state, instruction))
     {
-        printf("Failed to open font file: %s\n", args->font_path);
-        return 1;
+        state.halt = 1;
     }
+    debug_instruction(&state, instruction);
+    state.cycles++;
+    movie_record_step();
+}
 
-    fseek(font_file, 0, SEEK_END);
-    int font_size = ftell(font_file);
-    fseek(font_file, 0, SEEK_SET);
+static void print_speed(struct speed_control *control)
+{
+    if (control->turbo)
+        printf("Speed: turbo\n");
+    else
+        printf("Speed: x%.3g%s\n", (f64)control->speed / SPEED_ONE, control->paused ? " (paused)" : "");
+}
+
+static u8 hotkey_pressed(struct input *input, enum hotkey hotkey)
+{
+    return (input->hotkeys >> hotkey) & 0x1;
+}
+
+static u8 hotkey_held(struct input *input, enum hotkey hotkey)
+{
+    return (input->hotkeys_held >> hotkey) & 0x1;
+}
 
-    if (font_size < 80)
+// Left only rewinds while there's a frame to go back to, with rewind off (-w0, recording, replaying or linked) frames carry on as normal
+static u8 rewind_held(struct speed_control *control, struct input *input)
+{
+    return !control->paused && hotkey_held(input, HOTKEY_REWIND) && rewind_frames() > 0;
+}
+
+// Returns a step request made while paused
+static enum step handle_hotkeys(struct speed_control *control, struct frame_scheduler *scheduler, struct input *input)
+{
+    u32 speed = control->speed;
+    if (hotkey_pressed(input, HOTKEY_PAUSE))
     {
-        printf("Font file size is %d bytes, it should be 80 bytes\n", font_size);
-        return 1;
+        control->paused = !control->paused;
+        printf(control->paused ? "Paused\n" : "Resumed\n");
+    }
+    if (hotkey_pressed(input, HOTKEY_TURBO))
+    {
+        control->turbo = !control->turbo;
+        print_speed(control);
+        if (!control->turbo) scheduler_resume(scheduler);
+    }
+    if (hotkey_pressed(input, HOTKEY_SLOWER) && speed > SPEED_MIN) speed /= 2;
+    if (hotkey_pressed(input, HOTKEY_FASTER) && speed < SPEED_MAX) speed *= 2;
+    if (hotkey_pressed(input, HOTKEY_NORMAL_SPEED)) speed = SPEED_ONE;
+    if (speed != control->speed)
+    {
+        control->speed = speed;
+        scheduler_set_speed(scheduler, speed);
+        print_speed(control);
+    }
+
+    if (!control->paused) return STEP_NONE;
+    if (hotkey_pressed(input, HOTKEY_STEP_FRAME)) return STEP_FRAME;
+    if (hotkey_pressed(input, HOTKEY_STEP_INSTRUCTION)) return STEP_INSTRUCTION;
+    return STEP_NONE;
+}
+
+// Snapshots are taken on this thread and written on another, so saving never costs a frame
+static void save_slot(int slot)
+{
+    char path[PF_MAX_PATH];
+    snapshot_slot_path(slot, path, sizeof(path));
+
+    u64 start = pf_get_time_us();
+    u32 size = save_snapshot(&state, snapshot_buffer, sizeof(snapshot_buffer), SNAPSHOT_COMPRESSED);
+    printf("Saving slot %d, %" PRIu32 " bytes, snapshot took %" PRIu64 " us\n", slot, size, pf_get_time_us() - start);
+    pf_mkdir("states");
+    if (!pf_write_file_async(path, snapshot_buffer, size))
+    {
+        printf("Still writing the last save, slot %d not saved\n", slot);
+    }
+}
+
+static u8 load_slot(int slot)
+{
+    if (movie_recording() || movie_playing() || netplay_active())
+    {
+        printf("States can't be loaded while recording, replaying or linked\n");
+        return 0;
+    }
+
+    char path[PF_MAX_PATH];
+    snapshot_slot_path(slot, path, sizeof(path));
+    if (!load_snapshot_file(&state, path)) return 0;
+    printf("Loaded slot %d at pc %#06x\n", slot, state.cpu.pc);
+    return 1;
+}
+
+// Returns 1 if a state was loaded
+static u8 handle_state_hotkeys(int *slot, struct input *input)
+{
+    if (hotkey_pressed(input, HOTKEY_PREVIOUS_SLOT) || hotkey_pressed(input, HOTKEY_NEXT_SLOT))
+    {
+        int step = hotkey_pressed(input, HOTKEY_NEXT_SLOT) ? 1 : SNAPSHOT_SLOTS - 1;
+        *slot = (*slot + step) % SNAPSHOT_SLOTS;
+        printf("Slot %d\n", *slot);
+    }
+    if (hotkey_pressed(input, HOTKEY_SAVE_STATE)) save_slot(*slot);
+    if (hotkey_pressed(input, HOTKEY_LOAD_STATE)) return load_slot(*slot);
+    return 0;
+}
+
+int emulate(struct args *args)
+{
+    // Init platform code
+    pf_set_render_options(&args->render);
+    pf_set_audio_options(&args->audio);
+    init_platform();
+    if (!pf_load_keymap(args->keymap_path)) return 1;
+
+    // Init CPU
+    init_chip8(&state);
+
+    // Load rom and font into memory, a replay brings its own
+    if (args->replay_path != NULL)
+    {
+        if (!movie_play(&state, args->replay_path, &args->tick_rate)) return 1;
+    }
+    else
+    {
+        if (!load_rom(&state, args->rom_path)) return 1;
+        if (!load_font(&state, args->font_path)) return 1;
+    }
+    if (args->aot_path != NULL && !aot_load(args->aot_path)) return 1;
+    set_idle_skip(args->skip_idle);
+
+    int slot = args->resume_slot;
+    if (args->resume_set && !load_slot(slot)) return 1;
+
+    // A save state or recording brings its generator along unless -g asks for a new one
+    u32 seed = 0;
+    if (args->seed_set || (!args->resume_set && args->replay_path == NULL))
+    {
+        seed = args->seed_set ? args->seed : (u32)pf_get_time_ns();
+        seed_random(&state, seed);
     }
-    else if (font_size > 80)
+    if (args->record_path != NULL && !movie_record(&state, args->record_path, seed, args->tick_rate)) return 1;
+    if (args->player != 0 && !netplay_start(&state, args->player, args->port, &args->tick_rate)) return 1;
+
+    // Going back in time would take the keys and steps out of step with the recording or the other player
+    if (movie_recording() || movie_playing() || netplay_active())
     {
-        printf("Font file size is %d bytes, taking first 80 bytes\n", font_size);
+        if (args->rewind_mb > 0) printf("Rewind is off while recording, replaying or linked\n");
     }
-    printf("\n");
+    else if (args->rewind_mb > 0 && !rewind_init(args->rewind_mb * 1024 * 1024))
+    {
+        return 1;
+    }
+
+    // Frames are paced at 60Hz, each one runs a batch of instructions
+    struct frame_scheduler scheduler;
+    create_scheduler(&scheduler, args->tick_rate);
+
+    struct speed_control control;
+    control.paused = args->start_paused;
+    control.turbo = args->turbo;
+    control.speed = args->speed;
+    scheduler_set_speed(&scheduler, control.speed);
+    print_speed(&control);
 
-    fread(&state.memory[0x50], 1, 80, font_file);
-    fclose(font_file);
+    // Host CPU use, split between running and parked
+    struct host_usage usage;
+    start_usage(&usage);
 
-    // Timers
-    struct timer timer_60hz;
-    struct timer timer_instruction;
-    create_timer_us(&timer_60hz, (u64)(1000000.0f/60.0f));
-    create_timer_us(&timer_instruction, (u64)(1000000.0f/(float)args->tick_rate));
+    struct input input = {0};
+    init_histogram(&input_latency, 1000);
+    init_histogram(&screen_latency, 1000);
+    init_runahead(&ahead, args->runahead);
 
     // Start emulation
+    u64 last_present_us = 0;
     u8 loop = 1;
-    u16 instruction_bytes;
-    struct instruction instruction;
     while (loop)
     {
-        if (!pf_poll_events()) break;
+        // Nothing can change until a key is pressed if the program is paused or halted, or
+        // waiting for a key with both timers already at 0, unless it's being rewound. A replay
+        // or the other player brings keys too, frames keep running until they arrive, and
+        // while linked a parked emulator still wakes up to answer the other side
+        u8 rewinding = rewind_held(&control, &input);
+        u8 waiting = state.await_input && state.cpu.delay == 0 && state.cpu.sound == 0 && !movie_playing() && !netplay_active();
+        u8 parked = !rewinding && (control.paused || state.halt || waiting);
+        if (parked)
+        {
+            u64 wall = pf_get_time_us();
+            u64 cpu = pf_get_cpu_time_us();
+            if (!pf_wait_events(netplay_active() ? wall + NETPLAY_POLL_US : PF_WAIT_FOREVER)) break;
+            usage.parked_us += pf_get_time_us() - wall;
+            usage.parked_cpu_us += pf_get_cpu_time_us() - cpu;
+            scheduler_resume(&scheduler);
+        }
+        else if (control.turbo)
+        {
+            // Never sleeps, events are only checked between slices
+            if (!pf_poll_events()) break;
+        }
+        else
+        {
+            // Sleep until the next frame is due or an event arrives
+            if (!pf_wait_events(scheduler_next_deadline_us(&scheduler))) break;
+        }
+
+        gather_input(&input);
+        enum step step = handle_hotkeys(&control, &scheduler, &input);
+        u8 loaded = handle_state_hotkeys(&slot, &input);
+        rewinding = rewind_held(&control, &input);
 
-        if (state.await_input)
+        u32 frames = 0;
+        if (control.paused)
         {
-            u8 key = get_chip_key();
-            if (key != 0xFF)
+            if (step == STEP_FRAME)
+            {
+                run_frame(args, &scheduler, &input);
+                frames = 1;
+            }
+            else if (step == STEP_INSTRUCTION)
             {
-                state.cpu.v[state.input_register] = key;
-                if (args->debug)
-                    printf("Saving key %#03x into register v[%x]\n", key, state.input_register);
-                state.await_input = 0;
+                step_instruction();
             }
         }
-
-        // Emulate
-        if (!state.halt)
+        else if (control.turbo)
         {
-            // TODO: Beep when sound timer > 0
-
-            if (should_tick(&timer_instruction) && !state.await_input)
+            // As many frames as fit in one 60Hz slice of host time, so drawing never holds turbo back
+            u64 until = pf_get_time_us() + TURBO_SLICE_US;
+            do
             {
-                fetch_instruction(&state, &instruction_bytes);
-                decode_instruction(instruction_bytes, &instruction);
-                if (!execute_instruction(&state, &instruction))
-                {
-                    state.halt = 1;
-                }
-                if (args->debug)
-                {
-                    if (!debug_instruction(&state, &instruction))
-                    {
-                        state.halt = 1;
-                    }
-                }
-                pf_render_screen(&state);
-                state.cycles++;
-            }
-
-            if (should_tick(&timer_60hz))
+                advance_frame(args, &scheduler, &input, rewinding);
+                frames++;
+            } while ((rewinding ? rewind_frames() > 0 : !state.halt) && pf_get_time_us() < until);
+        }
+        else
+        {
+            frames = scheduler_frames_due(&scheduler);
+            for (u32 frame = 0; frame < frames; frame++)
             {
-                if (state.cpu.delay > 0)
-                {
-                    state.cpu.delay--;
-                }
-                if (state.cpu.sound > 0)
-                {
-                    state.cpu.sound--;
-                }
+                advance_frame(args, &scheduler, &input, rewinding);
             }
         }
+
+        // Late keys from the other player can change frames that already ran
+        netplay_poll(&state, args->engine);
+
+        // Frames are only published if something was drawn, and at about 60Hz however fast frames are running
+        u64 now = pf_get_time_us();
+        u8 due = frames > 0 && now - last_present_us >= PRESENT_MIN_GAP_US;
+        if (ahead.frames > 0 && due && !rewinding && !control.paused && !state.halt)
+        {
+            // The screen from a few frames on is shown, then the machine goes back to the real frame
+            u8 dirty = state.screen_dirty;
+            if (run_ahead(&ahead, &state, args->engine, &scheduler) || dirty) pf_render_screen(&state);
+            end_run_ahead(&ahead, &state);
+            state.screen_dirty = 0;
+            last_present_us = now;
+        }
+        else if (state.screen_dirty && (step != STEP_NONE || loaded || due))
+        {
+            pf_render_screen(&state);
+            state.screen_dirty = 0;
+            last_present_us = now;
+        }
+
+        // A screen that didn't change is already showing what the frame drew
+        if (unshown_event_us != 0 && (step != STEP_NONE || loaded || due))
+        {
+            u64 end = pf_get_time_us();
+            histogram_add(&screen_latency, end > unshown_event_us ? end - unshown_event_us : 0);
+            unshown_event_us = 0;
+        }
     }
 
+    print_scheduler_report(&scheduler);
+    print_usage(&usage);
+    print_histogram("Input latency", &input_latency);
+    print_histogram("Key to screen", &screen_latency);
+    print_runahead_report(&ahead);
+    print_rewind_report();
+    rewind_free();
+    movie_stop(&state);
+    netplay_stop();
+
     shutdown_platform();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,433 @@
+// Runs a rom with no window and no pacing to measure raw interpreter speed
+
+#include "common/types.h"
+#include "common/instructions.h"
+#include "common/chip8.h"
+#include "common/platform.h"
+#include "common/engine.h"
+#include "common/aot.h"
+#include "common/fusion.h"
+#include "common/terminal.h"
+#include "common/timer.h"
+#include "common/idle.h"
+#include "common/snapshot.h"
+#include "common/rewind.h"
+#include "common/movie.h"
+#include "common/runahead.h"
+#include "common/batch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define LAG_PROBES 8
+#define LAG_PROBE_MAX_FRAMES 120
+
+static struct chip8 state;
+static struct runahead ahead;
+
+// Finds how long a key press takes to reach the screen by running a second machine from
+// just before the press with the keys as they were, the first frame where the two show
+// different screens is when the press became visible
+struct lag_probe
+{
+    u8 active;
+    struct chip8 machine;
+    struct runahead ahead;
+    u16 held; // Keys held before the press
+    u64 frames; // Since the press
+};
+
+static struct lag_probe probes[LAG_PROBES];
+static u8 probe_payload[SNAPSHOT_PAYLOAD_SIZE];
+static struct histogram press_lag;
+static u64 presses_unseen; // Changed nothing within LAG_PROBE_MAX_FRAMES
+static u64 presses_missed; // Every probe was busy
+
+struct args
+{
+    const char *rom_path;
+    const char *font_path;
+    u32 tick_rate;
+    u64 max_cycles;
+    u64 max_frames;
+    enum engine engine;
+    u8 engine_set;
+    const char *aot_path;
+    enum terminal_mode view;
+    u8 skip_idle;
+    const char *load_path;
+    const char *save_path;
+    u32 rewind_mb;
+    const char *replay_path;
+    u8 seed_set;
+    u32 seed;
+    u32 runahead;
+    u32 machines; // Runs a batch when set
+    u32 threads;
+    u32 lanes;
+};
+
+int run_headless(struct args *args);
+
+int main(int argc, char *argv[])
+{
+    struct args args = {0};
+    args.engine = ENGINE_THREADED;
+    if (argc >= 2)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const char *str = argv[i];
+            if (str[0] == '-')
+            {
+                // Parse a flag
+                char flag = str[1];
+                switch(flag)
+                {
+                case 'f':
+                    args.font_path = str + 2;
+                    break;
+                case 't':
+                    args.tick_rate = atoi(str + 2);
+                    break;
+                case 'c':
+                    args.max_cycles = strtoull(str + 2, NULL, 10);
+                    break;
+                case 'n':
+                    args.max_frames = strtoull(str + 2, NULL, 10);
+                    break;
+                case 'a':
+                    args.aot_path = str + 2;
+                    args.engine = ENGINE_AOT;
+                    break;
+                case 'i':
+                    args.skip_idle = (u8)(atoi(str + 2) != 0);
+                    break;
+                case 'l':
+                    args.load_path = str + 2;
+                    break;
+                case 's':
+                    args.save_path = str + 2;
+                    break;
+                case 'w':
+                    args.rewind_mb = (u32)atoi(str + 2); // Negative numbers wrap round past the limit too
+                    if (args.rewind_mb > 1024)
+                    {
+                        printf("Rewind buffer should be between 0 and 1024 MB\n");
+                        return 1;
+                    }
+                    break;
+                case 'y':
+                    args.replay_path = str + 2;
+                    break;
+                case 'j':
+                    args.runahead = (u32)atoi(str + 2);
+                    if (args.runahead > RUNAHEAD_MAX_FRAMES)
+                    {
+                        printf("Run-ahead should be between 0 and %d frames\n", RUNAHEAD_MAX_FRAMES);
+                        return 1;
+                    }
+                    break;
+                case 'g':
+                    args.seed = (u32)strtoul(str + 2, NULL, 10);
+                    args.seed_set = 1;
+                    break;
+                case 'b':
+                    args.machines = (u32)strtoul(str + 2, NULL, 10);
+                    if (args.machines == 0)
+                    {
+                        printf("A batch needs at least one machine\n");
+                        return 1;
+                    }
+                    break;
+                case 'p':
+                    args.threads = (u32)atoi(str + 2);
+                    if (args.threads == 0 || args.threads > PF_MAX_THREADS)
+                    {
+                        printf("Threads should be between 1 and %d\n", PF_MAX_THREADS);
+                        return 1;
+                    }
+                    break;
+                case 'k':
+                    args.lanes = (u32)atoi(str + 2);
+                    if (args.lanes != 8 && args.lanes != 16 && args.lanes != 32)
+                    {
+                        printf("Lockstep groups should be 8, 16 or 32 lanes\n");
+                        return 1;
+                    }
+                    break;
+                case 'v':
+                    if (!parse_terminal_mode(str + 2, &args.view))
+                    {
+                        printf("Unknown view: %s\n", str + 2);
+                        return 1;
+                    }
+                    break;
+                case 'e':
+                    if (!parse_engine(str + 2, &args.engine))
+                    {
+                        printf("Unknown engine: %s\n", str + 2);
+                        return 1;
+                    }
+                    args.engine_set = 1;
+                    break;
+                default:
+                    printf("Unknown flag: %c\n", flag);
+                    return 1;
+                }
+            }
+            else
+            {
+                if (args.rom_path == NULL)
+                {
+                    args.rom_path = str;
+                }
+                else
+                {
+                    printf("Multiple rom paths specified\n");
+                    return 1;
+                }
+            }
+        }
+
+        if (args.rom_path == NULL && args.replay_path == NULL)
+        {
+            printf("No rom path specified\n");
+            return 1;
+        }
+
+        if (args.replay_path != NULL && args.seed_set)
+        {
+            printf("-g can't be used with -y, a recording brings its own generator\n");
+            return 1;
+        }
+
+        if (args.machines > 0 && (args.replay_path != NULL || args.save_path != NULL || args.rewind_mb > 0 || args.runahead > 0 ||
+            args.view != TERMINAL_OFF || args.max_cycles > 0 || args.skip_idle))
+        {
+            printf("-b can only be used with -f, -t, -n, -e, -g, -l, -p and -k\n");
+            return 1;
+        }
+
+        if (args.lanes > 0 && args.machines == 0)
+        {
+            printf("-k runs a batch, it needs -b\n");
+            return 1;
+        }
+
+        if (args.lanes > 0 && args.engine_set)
+        {
+            printf("-e can't be used with -k, lockstep groups run every machine themselves\n");
+            return 1;
+        }
+
+        if (args.font_path == NULL)
+        {
+            args.font_path = "fonts/default.font";
+        }
+
+        if (args.tick_rate == 0)
+        {
+            args.tick_rate = 1000;
+        }
+
+        if (args.max_cycles == 0 && args.max_frames == 0 && args.replay_path == NULL)
+        {
+            args.max_frames = 600;
+        }
+
+        return run_headless(&args);
+    }
+
+    printf("Usage: c8-headless <rom_path>\n\t-f\"<font_path>\"\n\t-t<tps> sets emulated tick rate\n\t-c<cycles> stop after this many instructions\n\t-n<frames> stop after this many 60Hz frames\n\t-e<engine> uncached, switch, threaded (default), jit, aot or fused\n\t-a\"<library>\" run a rom compiled by c8aot\n\t-v<view> half or braille, draws the screen in the terminal\n\t-i<0|1> skip idle loops, off by default so instruction rates measure the engine\n\t-l\"<snapshot>\" start from a save state\n\t-s\"<snapshot>\" save the state on exit\n\t-w<MB> capture every frame into a rewind buffer this size, then rewind through it and report the cost\n\t-g<seed> seed for the random number generator (default 0)\n\t-y\"<recording>\" replay a recording made by c8 -o as fast as possible, checking every framebuffer it recorded\n\t-j<frames> run ahead every frame and report the cost, with -y also how many frames each key press took to show\n\t-b<machines> run this many machines seeded -g, -g + 1 and so on across threads, for -n frames each\n\t-p<threads> threads for -b, one per processor by default (up to %d)\n\t-k<lanes> run -b in lockstep groups of 8, 16 or 32 machines, one instruction across a whole group at once\n", PF_MAX_THREADS);
+    return 1;
+}
+
+static void start_probe(struct chip8 *state, u16 held)
+{
+    for (int i = 0; i < LAG_PROBES; i++)
+    {
+        struct lag_probe *probe = &probes[i];
+        if (probe->active) continue;
+
+        write_snapshot_payload(state, probe_payload);
+        read_snapshot_payload(&probe->machine, probe_payload);
+        probe->held = held;
+        probe->frames = 0;
+        probe->active = 1;
+        return;
+    }
+    presses_missed++;
+}
+
+// Runs a probe's frame alongside the real one, shown is the hash of the screen the real one showed
+static void step_probe(struct lag_probe *probe, enum engine engine, struct frame_scheduler *scheduler, u32 budget, u64 shown)
+{
+    set_frame_keys(&probe->machine, probe->held, 0);
+    run_engine(&probe->machine, engine, budget);
+    tick_timers(&probe->machine);
+    probe->frames++;
+
+    u64 hash;
+    if (probe->ahead.frames > 0)
+    {
+        run_ahead(&probe->ahead, &probe->machine, engine, scheduler);
+        hash = hash_screen(&probe->machine);
+        end_run_ahead(&probe->ahead, &probe->machine);
+    }
+    else
+    {
+        hash = hash_screen(&probe->machine);
+    }
+
+    if (hash != shown)
+    {
+        histogram_add(&press_lag, probe->frames * 1000000 / FRAME_RATE);
+        probe->active = 0;
+    }
+    else if (probe->frames >= LAG_PROBE_MAX_FRAMES)
+    {
+        presses_unseen++;
+        probe->active = 0;
+    }
+}
+
+int run_headless(struct args *args)
+{
+    init_platform();
+    init_chip8(&state);
+
+    if (args->replay_path != NULL)
+    {
+        if (!movie_play(&state, args->replay_path, &args->tick_rate)) return 1;
+    }
+    else
+    {
+        if (!load_rom(&state, args->rom_path)) return 1;
+        if (!load_font(&state, args->font_path)) return 1;
+    }
+    if (args->aot_path != NULL && !aot_load(args->aot_path)) return 1;
+    set_idle_skip(args->skip_idle);
+    if (args->load_path != NULL && !load_snapshot_file(&state, args->load_path)) return 1;
+    if (args->seed_set) seed_random(&state, args->seed); // Otherwise the seed is 0, or whatever the snapshot had
+    if (args->rewind_mb > 0 && !rewind_init(args->rewind_mb * 1024 * 1024)) return 1;
+
+    if (args->machines > 0)
+    {
+        struct batch_options batch;
+        batch.machines = args->machines;
+        batch.threads = args->threads;
+        if (batch.threads == 0) batch.threads = pf_cpu_count() < PF_MAX_THREADS ? pf_cpu_count() : PF_MAX_THREADS;
+        batch.frames = args->max_frames;
+        batch.tick_rate = args->tick_rate;
+        batch.seed = args->seed;
+        batch.engine = args->engine;
+        batch.lanes = args->lanes;
+        u8 ok = run_batch(&state, &batch);
+        shutdown_platform();
+        return ok ? 0 : 1;
+    }
+
+    // Only used for the instruction budget, frames aren't paced
+    struct frame_scheduler scheduler;
+    create_scheduler(&scheduler, args->tick_rate);
+
+    u64 frames = 0;
+    u16 last_held = 0;
+    init_runahead(&ahead, args->runahead);
+    for (int i = 0; i < LAG_PROBES; i++)
+    {
+        init_chip8(&probes[i].machine);
+        init_runahead(&probes[i].ahead, args->runahead);
+    }
+    init_histogram(&press_lag, 1000000 / FRAME_RATE);
+
+    terminal_open(args->view);
+    u64 start = pf_get_time_us();
+    while (!state.halt)
+    {
+        if (args->max_frames && frames >= args->max_frames) break;
+        if (args->max_cycles && state.cycles >= args->max_cycles) break;
+        if (args->max_cycles && state.await_input) break; // Nothing will ever press a key
+
+        u32 budget = scheduler_budget(&scheduler);
+
+        if (args->max_cycles && state.cycles + budget > args->max_cycles)
+        {
+            budget = (u32)(args->max_cycles - state.cycles);
+        }
+
+        rewind_capture(&state);
+        if (movie_playing())
+        {
+            // Keys go in at the start of the frame the same way c8 puts them in
+            u16 held = 0;
+            u16 pressed = 0;
+            if (!movie_frame(&state, &held, &pressed)) break;
+            if (pressed) start_probe(&state, last_held);
+            set_frame_keys(&state, held, pressed);
+            last_held = held;
+        }
+        run_engine(&state, args->engine, budget);
+
+        tick_timers(&state);
+        frames++;
+
+        u64 shown;
+        if (ahead.frames > 0)
+        {
+            run_ahead(&ahead, &state, args->engine, &scheduler);
+            shown = hash_screen(&state);
+            end_run_ahead(&ahead, &state);
+        }
+        else
+        {
+            shown = movie_playing() ? hash_screen(&state) : 0;
+        }
+        for (int i = 0; i < LAG_PROBES; i++)
+        {
+            if (probes[i].active) step_probe(&probes[i], args->engine, &scheduler, budget, shown);
+        }
+
+        if (state.screen_dirty && terminal_present(&state, 0)) state.screen_dirty = 0;
+    }
+    u64 elapsed = pf_get_time_us() - start;
+
+    if (state.screen_dirty) terminal_present(&state, 1);
+    terminal_close();
+    movie_stop(&state);
+    f64 seconds = elapsed / 1000000.0;
+    if (seconds <= 0.0) seconds = 1e-6;
+
+    printf("Engine: %s\n", engine_names[args->engine]);
+    printf("Executed %" PRIu64 " instructions over %" PRIu64 " frames in %.3f s\n", state.cycles, frames, seconds);
+    printf("Instructions/sec: %.0f\n", state.cycles / seconds);
+    printf("Frames/sec: %.0f\n", frames / seconds);
+    printf("Framebuffer hash: %016" PRIx64 "\n", hash_screen(&state));
+    if (state.halt) printf("Halted at pc %#06x\n", state.cpu.pc);
+    if (state.await_input) printf("Waiting for input at pc %#06x\n", state.cpu.pc);
+    if (args->engine == ENGINE_FUSED) print_fusion_report();
+    if (args->skip_idle) print_idle_report();
+    print_runahead_report(&ahead);
+    if (args->replay_path != NULL)
+    {
+        printf("Run-ahead %" PRIu32 ", frames from a key press to a different screen:\n", args->runahead);
+        print_histogram("Key to screen", &press_lag);
+        if (presses_unseen) printf("  %" PRIu64 " presses changed nothing within %d frames\n", presses_unseen, LAG_PROBE_MAX_FRAMES);
+        if (presses_missed) printf("  %" PRIu64 " presses weren't measured, every probe was busy\n", presses_missed);
+    }
+    if (args->save_path != NULL && !save_snapshot_file(&state, args->save_path, SNAPSHOT_COMPRESSED)) return 1;
+
+    if (args->rewind_mb > 0)
+    {
+        // Restores are only timed by going back through the whole buffer
+        u32 frames = rewind_frames();
+        while (rewind_step(&state));
+        printf("Rewound %" PRIu32 " frames to cycle %" PRIu64 "\n", frames, state.cycles);
+        print_rewind_report();
+        rewind_free();
+    }
+
+    shutdown_platform();
+    return 0;
+}
\ No newline at end of file